@@ -0,0 +1,49 @@
+#!/bin/sh
+# Runs the example circuits and compares their output with the expected <name>.out
+# usage: examples/check.sh path/to/qatch
+
+QATCH=${1:?usage: $0 path/to/qatch}
+case $QATCH in
+    */*) QATCH=$(cd "$(dirname "$QATCH")" && pwd)/$(basename "$QATCH") ;;
+esac
+cd "$(dirname "$0")" || exit 1
+CKPT=$(mktemp)
+LOG=$(mktemp)
+trap 'rm -f "$CKPT" "$LOG"' EXIT
+FAILED=0
+
+# check <expected> <options...> <script>
+# A resume that falls back to the beginning gives the same output, so it fails on the warning
+check()
+{
+    expected=$1
+    shift
+    if "$QATCH" "$@" 2>"$LOG" | cmp -s - "$expected.out" && ! grep -q "No usable checkpoint" "$LOG"
+    then
+        echo "ok      $*"
+    else
+        echo "FAILED  $*"
+        FAILED=1
+    fi
+}
+
+# Every kernel against the output of the original simulator, with and without the optimiser
+check kernels -O0 kernels
+check kernels -O1 kernels
+# The QFT gate against its H + CP + SWAP circuit
+check qft qft
+check qft -O0 qft-circuit
+# The sparse and dense backends
+check adder --backend sparse adder
+check adder --backend dense adder
+# Batched inputs against one input per lane
+check truth --inputs all truth
+check truth --inputs all --lanes 1 truth
+# A complete run writes the checkpoints, a resumed run starts at the last one
+check resume --checkpoint-file "$CKPT" resume
+check resume --resume --checkpoint-file "$CKPT" resume
+# The diffusion the optimiser substitutes against the gates it replaces
+check grover -O0 grover
+check grover -O1 grover
+
+exit $FAILED
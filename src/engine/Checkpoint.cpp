@@ -0,0 +1,179 @@
+#include "Checkpoint.h"
+#include "Parallel.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+static const char CHECKPOINT_MAGIC[8] = {'Q','A','T','C','H','C','K','2'};
+static const uint32_t CHECKPOINT_COMPRESSED = 1;
+// Amplitudes per sequential write
+static const size_t CHECKPOINT_BLOCK = size_t(1) << 22;
+
+CheckpointGate::CheckpointGate()
+{
+    m_name = "checkpoint";
+}
+void CheckpointGate::act(Qregister &)
+{
+    ;
+}
+
+Checkpointer::Checkpointer()
+{
+    ;
+}
+
+Checkpointer::~Checkpointer()
+{
+    wait();
+}
+
+void Checkpointer::setPath(std::string path)
+{
+    m_path = path;
+}
+
+void Checkpointer::setCompress(bool compress)
+{
+    m_compress = compress;
+}
+
+void Checkpointer::wait()
+{
+    if (m_writer.joinable())
+    {
+        m_writer.join();
+    }
+}
+
+void Checkpointer::save(const Qregister &qregister, int numQubits, size_t cursor, size_t gateCount, uint64_t circuitHash)
+{
+    if (m_path.empty()) {return;}
+    // Only one write in flight, the snapshot buffer is reused between checkpoints
+    wait();
+    m_snapshot.resize(qregister.size());
+    parallelFor(qregister.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        std::copy(qregister.begin()+begin, qregister.begin()+end, m_snapshot.begin()+begin);
+    }, 4096);
+    CheckpointHeader header;
+    header.numQubits = numQubits;
+    header.flags = m_compress ? CHECKPOINT_COMPRESSED : 0;
+    header.cursor = cursor;
+    header.gateCount = gateCount;
+    header.circuitHash = circuitHash;
+    m_writer = std::thread(&Checkpointer::write, this, header);
+}
+
+void Checkpointer::write(CheckpointHeader header)
+{
+    writeState(m_path, m_snapshot, header);
+}
+
+// Writes through a temporary file that is renamed into place, so a crash never leaves a torn file
+bool Checkpointer::writeState(const std::string &path, const Qregister &state, CheckpointHeader header)
+{
+    std::string tmp = path + ".tmp";
+    FILE *file = std::fopen(tmp.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr<<"checkpoint: cannot open '"<<tmp<<"'"<<std::endl;
+        return false;
+    }
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    bool compress = header.flags & CHECKPOINT_COMPRESSED;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!compress)
+    {
+        for (size_t n=0; n<state.size() && ok; n+=CHECKPOINT_BLOCK)
+        {
+            size_t count = std::min(CHECKPOINT_BLOCK, state.size()-n);
+            ok = std::fwrite(&state[n], sizeof(c), count, file) == count;
+        }
+    } else {
+        // Zero-run encoding: (zero run, literal count, literals...) records, buffered into large writes
+        std::vector<char> buffer;
+        buffer.reserve(CHECKPOINT_BLOCK*sizeof(c));
+        size_t n = 0;
+        while (n < state.size() && ok)
+        {
+            uint64_t zeros = 0;
+            while (n < state.size() && state[n] == c(0.0, 0.0)) {++zeros; ++n;}
+            size_t start = n;
+            while (n < state.size() && state[n] != c(0.0, 0.0) && n-start < CHECKPOINT_BLOCK) {++n;}
+            uint64_t literals = n - start;
+            buffer.insert(buffer.end(), (char*)&zeros, (char*)&zeros + sizeof(zeros));
+            buffer.insert(buffer.end(), (char*)&literals, (char*)&literals + sizeof(literals));
+            buffer.insert(buffer.end(), (const char*)&state[start], (const char*)(state.data() + n));
+            if (buffer.size() >= CHECKPOINT_BLOCK*sizeof(c) || n == state.size())
+            {
+                ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+                buffer.clear();
+            }
+        }
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::cerr<<"checkpoint: failed to write '"<<path<<"'"<<std::endl;
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Checkpointer::load(Qregister &qregister, int numQubits, size_t &cursor, size_t gateCount, uint64_t circuitHash)
+{
+    CheckpointHeader header;
+    bool ok = readState(m_path, qregister, header, [&](const CheckpointHeader &h)
+    {
+        if (h.circuitHash != circuitHash)
+        {
+            std::cerr<<"checkpoint: '"<<m_path<<"' was written by a different circuit"<<std::endl;
+            return false;
+        }
+        return h.numQubits == (uint32_t)numQubits && h.gateCount == gateCount && h.cursor <= gateCount;
+    });
+    if (ok) {cursor = header.cursor;}
+    return ok;
+}
+
+// Reads the header, asks accept whether to go on, then fills the register
+bool Checkpointer::readState(const std::string &path, Qregister &qregister, CheckpointHeader &header, const std::function<bool(const CheckpointHeader &)> &accept)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {return false;}
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+        && std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0
+        && header.numQubits < 64
+        && (size_t(1) << header.numQubits) == qregister.size()
+        && accept(header);
+    if (ok && !(header.flags & CHECKPOINT_COMPRESSED))
+    {
+        for (size_t n=0; n<qregister.size() && ok; n+=CHECKPOINT_BLOCK)
+        {
+            size_t count = std::min(CHECKPOINT_BLOCK, qregister.size()-n);
+            ok = std::fread(&qregister[n], sizeof(c), count, file) == count;
+        }
+    } else if (ok) {
+        size_t n = 0;
+        while (n < qregister.size() && ok)
+        {
+            uint64_t zeros, literals;
+            ok = std::fread(&zeros, sizeof(zeros), 1, file) == 1
+                && std::fread(&literals, sizeof(literals), 1, file) == 1
+                && n + zeros + literals <= qregister.size();
+            if (!ok) {break;}
+            std::fill(qregister.begin()+n, qregister.begin()+n+zeros, c(0.0, 0.0));
+            n += zeros;
+            ok = std::fread(qregister.data()+n, sizeof(c), literals, file) == literals;
+            n += literals;
+        }
+    }
+    std::fclose(file);
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef Checkpoint_H
+#define Checkpoint_H
+
+#include "Gate.h"
+#include <thread>
+#include <cstdint>
+#include <functional>
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t numQubits;
+    uint32_t flags;
+    uint64_t cursor;
+    uint64_t gateCount;
+    // Hash of the compiled gate stream, a checkpoint only resumes the circuit that wrote it
+    uint64_t circuitHash;
+};
+
+// Marker left in the gate list by the checkpoint instruction
+class CheckpointGate : public Gate
+{
+public:
+	CheckpointGate();
+	void act(Qregister &qregister);
+	bool isCheckpoint() {return true;}
+	std::vector<int> qubits() {return {};}
+	void remap(const std::vector<int> &) {;}
+};
+
+// Writes the register and gate cursor to disk on a background thread. The register is
+// snapshotted first, by all workers, so the simulation can keep running while the file is
+// written. The snapshot is a second copy of the register and is kept between checkpoints.
+class Checkpointer
+{
+public:
+    Checkpointer();
+    void setPath(std::string path);
+    void setCompress(bool compress);
+    void save(const Qregister &qregister, int numQubits, size_t cursor, size_t gateCount, uint64_t circuitHash);
+    bool load(Qregister &qregister, int numQubits, size_t &cursor, size_t gateCount, uint64_t circuitHash);
+    void wait();
+    // Checkpoint file format, shared with the prefix state cache
+    static bool writeState(const std::string &path, const Qregister &state, CheckpointHeader header);
+    static bool readState(const std::string &path, Qregister &qregister, CheckpointHeader &header, const std::function<bool(const CheckpointHeader &)> &accept);
+    ~Checkpointer();
+private:
+    void write(CheckpointHeader header);
+
+    std::string m_path;
+    bool m_compress = false;
+    Qregister m_snapshot;
+    std::thread m_writer;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "CustomGate.h"
+#include <algorithm>
 
 typedef std::complex<double> c;
 
@@ -9,10 +10,61 @@ CustomGate::CustomGate(std::string name, std::vector<std::unique_ptr<Gate>> gate
     m_name = name;
     m_gates = std::move(gates);
 }
-void CustomGate::act(std::vector<c> &qregister)
+void CustomGate::act(Qregister &qregister)
 {
     for (auto&& g : m_gates)
     {
         g->act(qregister);
     }
+}
+void CustomGate::actTrajectory(Qregister &qregister, std::mt19937_64 &rng)
+{
+    for (auto&& g : m_gates)
+    {
+        g->actTrajectory(qregister, rng);
+    }
+}
+bool CustomGate::isNoisy()
+{
+    for (auto&& g : m_gates)
+    {
+        if (g->isNoisy()) {return true;}
+    }
+    return false;
+}
+std::vector<int> CustomGate::qubits()
+{
+    std::vector<int> qs;
+    for (auto&& g : m_gates)
+    {
+        for (int q : g->qubits())
+        {
+            if (std::find(qs.begin(), qs.end(), q) == qs.end()) {qs.push_back(q);}
+        }
+    }
+    std::sort(qs.begin(), qs.end());
+    return qs;
+}
+std::string CustomGate::key()
+{
+    std::string k = m_name;
+    k.push_back('\0');
+    for (auto&& g : m_gates)
+    {
+        std::string sub = g->key();
+        appendKey(k, uint64_t(sub.size()));
+        k += sub;
+    }
+    return k;
+}
+void CustomGate::remap(const std::vector<int> &map)
+{
+    for (auto&& g : m_gates)
+    {
+        g->remap(map);
+    }
+}
+std::vector<std::unique_ptr<Gate>> CustomGate::releaseGates()
+{
+    return std::move(m_gates);
 }
\ No newline at end of file
@@ -7,7 +7,14 @@ class CustomGate : public Gate
 {
 public:
 	CustomGate(std::string name, std::vector<std::unique_ptr<Gate>>);
-	void act(std::vector<c> &qregister);
+	void act(Qregister &qregister);
+	void actTrajectory(Qregister &qregister, std::mt19937_64 &rng);
+	bool isNoisy();
+	std::vector<int> qubits();
+	std::string key();
+	void remap(const std::vector<int> &map);
+	std::vector<std::unique_ptr<Gate>> releaseGates();
+	std::vector<std::unique_ptr<Gate>> &gates() {return m_gates;}
 protected:
 	std::vector<std::unique_ptr<Gate>> m_gates;
 };
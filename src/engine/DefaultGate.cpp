@@ -1,8 +1,12 @@
 #include "DefaultGate.h"
+#include "MatrixKernel.h"
+#include "SparseRegister.h"
+#include <algorithm>
 
 typedef std::complex<double> c;
 
 const double pi = acos(-1.0);
+const double sqrt_half = 1.0/pow(2.0,0.5);
 
 void DefaultGate::setActive(int activeQubit)
 {
@@ -11,47 +15,76 @@ void DefaultGate::setActive(int activeQubit)
 
 void DefaultGate::setControl(std::vector<int> controlQubits)
 {
-	m_controlQubits = controlQubits;
+	m_controlQubits = std::move(controlQubits);
 };
 
-void MatrixGate::act(std::vector<c> &qregister)
+std::vector<int> DefaultGate::qubits()
 {
-    bool controls_passed = true;
-    std::vector<c> temp(qregister.size(), c(0.0, 0.0));
-    for (int n=0; n<qregister.size(); ++n) 
+    std::vector<int> qs = m_controlQubits;
+    qs.push_back(m_activeQubit);
+    return qs;
+}
+
+void DefaultGate::remap(const std::vector<int> &map)
+{
+    m_activeQubit = map[m_activeQubit];
+    for (auto &cq : m_controlQubits)
     {
-        for (auto cq : m_controlQubits) 
-        {
-            if (!(n % static_cast<int>(pow(2,cq)) >= pow(2,cq-1)))
-            {
-                controls_passed = false;
-            }       
-        }
-        if (controls_passed)
-        {
-            if (n % static_cast<int>(pow(2,m_activeQubit)) >= pow(2,m_activeQubit-1))
-            {
-                temp[n] += qregister[n]*(m_matrix[3]);
-                temp[n - pow(2, m_activeQubit-1)] += qregister[n]*(m_matrix[1]);
-            } else {
-                temp[n] += qregister[n]*(m_matrix[0]);
-                temp[n + pow(2, m_activeQubit-1)] += qregister[n]*(m_matrix[2]);
-            }               
-        } else {
-            temp[n] += qregister[n];    
-        }
-        controls_passed=true;
+        cq = map[cq];
     }
-    for (int n{}; n<qregister.size(); n++)
+}
+
+uint64_t DefaultGate::controlMask()
+{
+    uint64_t mask = 0;
+    for (int cq : m_controlQubits)
+    {
+        mask |= uint64_t(1) << (cq-1);
+    }
+    return mask;
+}
+
+bool MatrixGate::actSparse(SparseRegister &sparse)
+{
+    sparse.applyMatrix(m_matrix.data(), m_activeQubit-1, controlMask());
+    return true;
+}
+
+void MatrixGate::act(Qregister &qregister)
+{
+    std::vector<int> controlBits;
+    for (int cq : m_controlQubits)
     {
-        qregister[n] = temp[n];
+        controlBits.push_back(cq-1);
     }
+    applyMatrix(qregister, m_matrix.data(), m_activeQubit-1, controlBits);
+}
+
+MatrixGate::MatrixGate(std::string name, int activeQubit, std::vector<c> matrix, std::vector<int> controlQubits)
+{
+    m_name = name;
+    m_activeQubit = activeQubit;
+    std::copy(matrix.begin(), matrix.end(), m_matrix.begin());
+    m_controlQubits = std::move(controlQubits);
+}
+
+std::string MatrixGate::key()
+{
+    std::string k = Gate::key();
+    appendKey(k, matrix());
+    return k;
+}
+
+bool MatrixGate::isDiagonal()
+{
+    return m_matrix[1] == c(0.0, 0.0) && m_matrix[2] == c(0.0, 0.0);
 }
 
 
 IdentityGate::IdentityGate() {};
 IdentityGate::IdentityGate(int activeQubit) 
 {
+    m_name = "I";
     m_activeQubit = activeQubit;
     m_matrix = {c(1.0, 0.0), c(0.0, 0.0), c(0.0, 0.0), c(1.0, 0.0)};
 
@@ -60,134 +93,181 @@ IdentityGate::IdentityGate(int activeQubit)
 HadamardGate::HadamardGate() {};
 HadamardGate::HadamardGate(int activeQubit) 
 {
+    m_name = "H";
     m_activeQubit = activeQubit;
-    m_matrix = {c(1.0/(pow(2.0,0.5)), 0.0), c(1.0/(pow(2.0,0.5)), 0.0), c(1.0/(pow(2.0,0.5)), 0.0), c(-1.0/(pow(2.0,0.5)), 0.0)};
+    m_matrix = {c(sqrt_half, 0.0), c(sqrt_half, 0.0), c(sqrt_half, 0.0), c(-sqrt_half, 0.0)};
 
 }
 HadamardGate::HadamardGate(int activeQubit, std::vector<int> controlQubits) : HadamardGate(activeQubit) 
 {
-    m_controlQubits = controlQubits;
+    m_controlQubits = std::move(controlQubits);
 }
 
 XGate::XGate() {};
 XGate::XGate(int activeQubit) 
 {
+    m_name = "X";
     m_activeQubit = activeQubit; 
     m_matrix = {c(0.0, 0.0), c(1.0, 0.0), c(1.0, 0.0), c(0.0, 0.0)};
 }
 XGate::XGate(int activeQubit, std::vector<int> controlQubits) : XGate(activeQubit) 
 {
-    m_controlQubits = controlQubits; 
+    m_controlQubits = std::move(controlQubits); 
 }
 
 YGate::YGate() {};
 YGate::YGate(int activeQubit)
 {
+    m_name = "Y";
     m_activeQubit = activeQubit; 
     m_matrix = {c(0.0, 0.0), c(0.0, -1.0), c(0.0, 1.0), c(0.0, 0.0)};
 }
 YGate::YGate(int activeQubit, std::vector<int> controlQubits) : YGate(activeQubit)
 {
-    m_controlQubits = controlQubits; 
+    m_controlQubits = std::move(controlQubits); 
 }
 
 ZGate::ZGate() {};
 ZGate::ZGate(int activeQubit) 
 {
+    m_name = "Z";
     m_activeQubit = activeQubit; 
     m_matrix = {c(1.0, 0.0), c(0.0, 0.0), c(0.0, 0.0), c(-1.0, 0.0)};
 }
 ZGate::ZGate(int activeQubit, std::vector<int> controlQubits) : ZGate(activeQubit)
 {
-    m_controlQubits = controlQubits; 
+    m_controlQubits = std::move(controlQubits); 
 }
 
 PhaseShiftGate::PhaseShiftGate() {};
 PhaseShiftGate::PhaseShiftGate(int activeQubit, double phi) 
 {
+    m_name = "P";
     m_activeQubit = activeQubit; 
     m_phase = phi;
     m_matrix = {c(1.0, 0.0), c(0.0, 0.0), c(0.0, 0.0), c(std::polar(1.0,phi))};
 }
 PhaseShiftGate::PhaseShiftGate(int activeQubit, double phase, std::vector<int> controlQubits) : PhaseShiftGate(activeQubit, phase)
 {
-    m_controlQubits = controlQubits;
+    m_controlQubits = std::move(controlQubits);
 }
 
 RotationXGate::RotationXGate() {};
 RotationXGate::RotationXGate(int activeQubit, double phi) 
 {
+    m_name = "RX";
     m_activeQubit = activeQubit; 
     m_theta = phi;
     m_matrix = {c(std::cos(phi/2), 0.0), c(0.0, -std::sin(phi/2)), c(0.0, -std::sin(phi/2)), c(std::cos(phi/2), 0.0)};
 }
 RotationXGate::RotationXGate(int activeQubit, double phi, std::vector<int> controlQubits) : RotationXGate(activeQubit, phi)
 {
-    m_controlQubits = controlQubits;
+    m_controlQubits = std::move(controlQubits);
 }
 
 RotationYGate::RotationYGate() {};
 RotationYGate::RotationYGate(int activeQubit, double phi) 
 {
+    m_name = "RY";
     m_activeQubit = activeQubit; 
     m_theta = phi;
     m_matrix = {c(std::cos(phi/2), 0.0), c(-std::sin(phi/2), 0.0), c(std::sin(phi/2), 0.0), c(std::cos(phi/2), 0.0)};
 }
 RotationYGate::RotationYGate(int activeQubit, double phi, std::vector<int> controlQubits) : RotationYGate(activeQubit, phi)
 {
-    m_controlQubits = controlQubits;
+    m_controlQubits = std::move(controlQubits);
 }
 
 RotationZGate::RotationZGate() {};
 RotationZGate::RotationZGate(int activeQubit, double phi) 
 {
+    m_name = "RZ";
     m_activeQubit = activeQubit; 
     m_theta = phi;
     m_matrix = {c(std::polar(1.0,-phi/2)), c(0.0, 0.0), c(0.0, 0.0), c(std::polar(1.0,phi/2))};
 }
 RotationZGate::RotationZGate(int activeQubit, double phi, std::vector<int> controlQubits) : RotationZGate(activeQubit, phi)
 {
-    m_controlQubits = controlQubits;
+    m_controlQubits = std::move(controlQubits);
+}
+
+U1Gate::U1Gate() {};
+U1Gate::U1Gate(int activeQubit, double lambda)
+{
+    m_name = "U1";
+    m_activeQubit = activeQubit;
+    m_lambda = lambda;
+    m_matrix = {c(1.0, 0.0), c(0.0, 0.0), c(0.0, 0.0), c(std::polar(1.0,lambda))};
+}
+U1Gate::U1Gate(int activeQubit, double lambda, std::vector<int> controlQubits) : U1Gate(activeQubit, lambda)
+{
+    m_controlQubits = std::move(controlQubits);
+}
+
+U2Gate::U2Gate() {};
+U2Gate::U2Gate(int activeQubit, double phi, double lambda)
+{
+    m_name = "U2";
+    m_activeQubit = activeQubit;
+    m_phi = phi;
+    m_lambda = lambda;
+    double r = 1.0/(pow(2.0,0.5));
+    m_matrix = {c(r, 0.0), -std::polar(r,lambda), std::polar(r,phi), std::polar(r,phi+lambda)};
+}
+U2Gate::U2Gate(int activeQubit, double phi, double lambda, std::vector<int> controlQubits) : U2Gate(activeQubit, phi, lambda)
+{
+    m_controlQubits = std::move(controlQubits);
+}
+
+U3Gate::U3Gate() {};
+U3Gate::U3Gate(int activeQubit, double theta, double phi, double lambda)
+{
+    m_name = "U3";
+    m_activeQubit = activeQubit;
+    m_theta = theta;
+    m_phi = phi;
+    m_lambda = lambda;
+    m_matrix = {c(std::cos(theta/2), 0.0), -std::polar(std::sin(theta/2),lambda), std::polar(std::sin(theta/2),phi), std::polar(std::cos(theta/2),phi+lambda)};
+}
+U3Gate::U3Gate(int activeQubit, double theta, double phi, double lambda, std::vector<int> controlQubits) : U3Gate(activeQubit, theta, phi, lambda)
+{
+    m_controlQubits = std::move(controlQubits);
 }
 
 SwapGate::SwapGate() {};
 SwapGate::SwapGate(int activeQubit, int swapQubit) 
 {
+    m_name = "SWAP";
     m_activeQubit = activeQubit; 
     m_swapQubit = swapQubit;
 }
 SwapGate::SwapGate(int activeQubit, int swapQubit, std::vector<int> controlQubits) : SwapGate(activeQubit, swapQubit)
 {
-    m_controlQubits = controlQubits;
+    m_controlQubits = std::move(controlQubits);
 }
-void SwapGate::act(std::vector<c> &qregister)
+std::vector<int> SwapGate::qubits()
 {
-    bool controls_passed = true;
-    std::vector<c> temp(qregister.size(), c(0.0, 0.0));
-    for (int n=0; n<qregister.size(); ++n) 
-    {
-        for (auto cq : m_controlQubits) 
-        {
-            if (!(n % static_cast<int>(pow(2,cq)) >= pow(2,cq-1)))
-            {
-                controls_passed = false;
-            }       
-        }
-        if (controls_passed)
-        {
-            int bit1 =  (n >> (m_activeQubit-1)) & 1;
-            int bit2 =  (n >> (m_swapQubit-1)) & 1;
-            int x = (bit1 ^ bit2);
-            x = (x << (m_activeQubit-1)) | (x << (m_swapQubit-1));
-            int result = n ^ x;
-            temp[result] = qregister[n];              
-        } else {
-            temp[n] += qregister[n];    
-        }
-        controls_passed=true;
-    }
-    for (int n{}; n<qregister.size(); n++)
+    std::vector<int> qs = DefaultGate::qubits();
+    qs.push_back(m_swapQubit);
+    return qs;
+}
+void SwapGate::remap(const std::vector<int> &map)
+{
+    DefaultGate::remap(map);
+    m_swapQubit = map[m_swapQubit];
+}
+bool SwapGate::actSparse(SparseRegister &sparse)
+{
+    sparse.applySwap(m_activeQubit-1, m_swapQubit-1, controlMask());
+    return true;
+}
+
+void SwapGate::act(Qregister &qregister)
+{
+    std::vector<int> controlBits;
+    for (int cq : m_controlQubits)
     {
-        qregister[n] = temp[n];
+        controlBits.push_back(cq-1);
     }
+    applySwap(qregister, m_activeQubit-1, m_swapQubit-1, controlBits);
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define DefaultGate_H
 
 #include "Gate.h"
+#include <array>
 #include <cmath>
 
 class DefaultGate : public Gate
@@ -9,7 +10,12 @@ class DefaultGate : public Gate
 public:
 	void setActive(int activeQubit);
 	void setControl(std::vector<int> contolQubits);
+	int activeQubit() {return m_activeQubit;}
+	std::vector<int> controlQubits() {return m_controlQubits;}
+	std::vector<int> qubits();
+	void remap(const std::vector<int> &map);
 protected:
+	uint64_t controlMask();
 	std::vector<int> m_controlQubits;
 	int m_activeQubit;
 };
@@ -18,9 +24,16 @@ protected:
 class MatrixGate : public DefaultGate
 {
 public:
-    void act(std::vector<c> &qregister);
+    MatrixGate() {};
+    MatrixGate(std::string name, int activeQubit, std::vector<c> matrix, std::vector<int> controlQubits);
+    void act(Qregister &qregister);
+    bool actSparse(SparseRegister &sparse);
+    bool isDiagonal();
+    std::string key();
+    std::vector<c> matrix() {return std::vector<c>(m_matrix.begin(), m_matrix.end());}
 protected:
-    std::vector<std::complex<double>> m_matrix;
+    // Held in the gate rather than on the heap, scripts can hold millions of gates
+    std::array<std::complex<double>, 4> m_matrix;
 };
 
 class IdentityGate : public MatrixGate
@@ -104,13 +117,50 @@ protected:
 	double m_theta = 0;
 };
 
+class U1Gate : public MatrixGate
+{
+public:
+	U1Gate();
+	U1Gate(int activeQubit, double lambda);
+	U1Gate(int activeQubit, double lambda, std::vector<int> controlQubits);
+protected:
+	double m_lambda = 0;
+};
+
+class U2Gate : public MatrixGate
+{
+public:
+	U2Gate();
+	U2Gate(int activeQubit, double phi, double lambda);
+	U2Gate(int activeQubit, double phi, double lambda, std::vector<int> controlQubits);
+protected:
+	double m_phi = 0;
+	double m_lambda = 0;
+};
+
+class U3Gate : public MatrixGate
+{
+public:
+	U3Gate();
+	U3Gate(int activeQubit, double theta, double phi, double lambda);
+	U3Gate(int activeQubit, double theta, double phi, double lambda, std::vector<int> controlQubits);
+protected:
+	double m_theta = 0;
+	double m_phi = 0;
+	double m_lambda = 0;
+};
+
 class SwapGate : public DefaultGate
 {
 public:
 	SwapGate();
 	SwapGate(int activeQubit, int swapQubit);
 	SwapGate(int activeQubit, int swapQubit, std::vector<int> controlQubits);
-	void act(std::vector<c> &qregister);
+	void act(Qregister &qregister);
+	bool actSparse(SparseRegister &sparse);
+	std::vector<int> qubits();
+	void remap(const std::vector<int> &map);
+	int swapQubit() {return m_swapQubit;}
 protected:
 	int m_swapQubit = 0;
 };
@@ -0,0 +1,140 @@
+#include "DiagonalGate.h"
+#include "Parallel.h"
+#include "SparseRegister.h"
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+static const int GROUP_BITS = 8;
+static const size_t GROUP_SIZE = size_t(1) << GROUP_BITS;
+
+static c termPhase(const DiagonalTerm &t, size_t n)
+{
+    if ((n & t.controlMask) != t.controlMask) {return c(1.0, 0.0);}
+    return (n & t.activeBit) ? t.d1 : t.d0;
+}
+
+DiagonalGate::DiagonalGate(std::vector<DiagonalTerm> terms)
+{
+    m_name = "diagonal";
+    m_terms = terms;
+    // A table only pays off for a group with two or more terms and only spans the bits of the
+    // group in use, long scripts fuse many short runs and every run keeps its own tables
+    std::vector<int> groups(terms.size(), -1);
+    std::vector<size_t> counts;
+    std::vector<size_t> entries;
+    size_t used = 0;
+    for (size_t i=0; i<terms.size(); ++i)
+    {
+        size_t mask = terms[i].controlMask | terms[i].activeBit;
+        used |= mask;
+        int group = 0;
+        while (GROUP_BITS*(group+1) < 64 && (mask >> (GROUP_BITS*(group+1))) != 0) {++group;}
+        if ((mask >> (GROUP_BITS*group)) << (GROUP_BITS*group) != mask) {continue;}
+        groups[i] = group;
+        if ((int)counts.size() <= group)
+        {
+            counts.resize(group+1, 0);
+            entries.resize(group+1, 1);
+        }
+        ++counts[group];
+        while (entries[group] <= (mask >> (GROUP_BITS*group))) {entries[group] <<= 1;}
+    }
+    for (size_t i=0; i<terms.size(); ++i)
+    {
+        int group = groups[i];
+        if (group < 0 || counts[group] < 2)
+        {
+            m_crossTerms.push_back(terms[i]);
+            continue;
+        }
+        if ((int)m_tables.size() <= group) {m_tables.resize(group+1);}
+        std::vector<c> &table = m_tables[group];
+        if (table.empty()) {table.assign(entries[group], c(1.0, 0.0));}
+        for (size_t idx=0; idx<table.size(); ++idx)
+        {
+            table[idx] *= termPhase(terms[i], idx << (GROUP_BITS*group));
+        }
+    }
+    for (int q=1; used; ++q, used>>=1)
+    {
+        if (used & 1) {m_qubits.push_back(q);}
+    }
+}
+
+std::string DiagonalGate::key()
+{
+    std::string k = m_name;
+    k.push_back('\0');
+    for (auto &t : m_terms)
+    {
+        appendKey(k, t.controlMask);
+        appendKey(k, t.activeBit);
+        appendKey(k, t.d0);
+        appendKey(k, t.d1);
+    }
+    return k;
+}
+
+void DiagonalGate::remap(const std::vector<int> &map)
+{
+    auto remapMask = [&](size_t mask)
+    {
+        size_t result = 0;
+        for (int q=1; mask; ++q, mask>>=1)
+        {
+            if (mask & 1) {result |= size_t(1) << (map[q]-1);}
+        }
+        return result;
+    };
+    std::vector<DiagonalTerm> terms = m_terms;
+    for (auto &t : terms)
+    {
+        t.controlMask = remapMask(t.controlMask);
+        t.activeBit = remapMask(t.activeBit);
+    }
+    *this = DiagonalGate(terms);
+}
+
+bool DiagonalGate::actSparse(SparseRegister &sparse)
+{
+    sparse.applyDiagonal([&](uint64_t n)
+    {
+        c phase(1.0, 0.0);
+        for (auto &t : m_terms)
+        {
+            phase *= termPhase(t, n);
+        }
+        return phase;
+    });
+    return true;
+}
+
+void DiagonalGate::act(Qregister &qregister)
+{
+    size_t blockSize = std::min(GROUP_SIZE, qregister.size());
+    size_t blocks = qregister.size()/blockSize;
+    const std::vector<c> *low = (!m_tables.empty() && !m_tables[0].empty()) ? &m_tables[0] : nullptr;
+    parallelFor(blocks, [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t b=begin; b<end; ++b)
+        {
+            size_t base = b*blockSize;
+            // Groups above the first are constant across a block
+            c high(1.0, 0.0);
+            for (size_t g=1; g<m_tables.size(); ++g)
+            {
+                if (!m_tables[g].empty()) {high *= m_tables[g][(base >> (GROUP_BITS*g)) & (m_tables[g].size()-1)];}
+            }
+            for (size_t n=base; n<base+blockSize; ++n)
+            {
+                c phase = low ? high*(*low)[n & (low->size()-1)] : high;
+                for (auto &t : m_crossTerms)
+                {
+                    phase *= termPhase(t, n);
+                }
+                qregister[n] *= phase;
+            }
+        }
+    }, 64);
+}
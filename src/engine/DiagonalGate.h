@@ -0,0 +1,36 @@
+#ifndef DiagonalGate_H
+#define DiagonalGate_H
+
+#include "Gate.h"
+
+// Phase d0 or d1 picked by the active bit, applied when every control bit is set
+struct DiagonalTerm
+{
+    size_t controlMask;
+    size_t activeBit;
+    c d0;
+    c d1;
+};
+
+// Product of a run of diagonal gates applied in a single pass. Terms confined to one
+// 8-qubit group, when the group has more than one, are folded into that group's lookup
+// table of up to 256 entries.
+class DiagonalGate : public Gate
+{
+public:
+	DiagonalGate(std::vector<DiagonalTerm> terms);
+	void act(Qregister &qregister);
+	bool actSparse(SparseRegister &sparse);
+	bool isDiagonal() {return true;}
+	std::vector<int> qubits() {return m_qubits;}
+	std::vector<DiagonalTerm> terms() {return m_terms;}
+	std::string key();
+	void remap(const std::vector<int> &map);
+protected:
+	std::vector<DiagonalTerm> m_terms;
+	std::vector<int> m_qubits;
+	std::vector<std::vector<c>> m_tables;
+	std::vector<DiagonalTerm> m_crossTerms;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "DiffusionGate.h"
+#include "Parallel.h"
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+DiffusionGate::DiffusionGate(std::vector<int> qubits, double sign)
+{
+    m_name = "DIFFUSE";
+    m_qubits = qubits;
+    m_sign = sign;
+    m_mask = 0;
+    for (int q : qubits)
+    {
+        m_mask |= size_t(1) << (q-1);
+    }
+}
+
+void DiffusionGate::remap(const std::vector<int> &map)
+{
+    std::vector<int> qubits;
+    for (int q : m_qubits)
+    {
+        qubits.push_back(map[q]);
+    }
+    *this = DiffusionGate(qubits, m_sign);
+}
+
+// Scatters the low bits of value into the set bits of mask
+static size_t deposit(size_t value, size_t mask)
+{
+    size_t result = 0;
+    for (size_t bit=1; mask; bit<<=1)
+    {
+        size_t lowest = mask & (~mask + 1);
+        if (value & bit) {result |= lowest;}
+        mask ^= lowest;
+    }
+    return result;
+}
+
+void DiffusionGate::act(Qregister &qregister)
+{
+    size_t size = qregister.size();
+    size_t mask = m_mask & (size-1);
+    size_t outerMask = (size-1) & ~mask;
+    size_t blockSize = size_t(1) << m_qubits.size();
+    c *a = qregister.data();
+    if (outerMask == 0)
+    {
+        std::vector<c> partial(parallelWorkers(), c(0.0, 0.0));
+        parallelFor(size, [&](size_t begin, size_t end, unsigned worker)
+        {
+            c sum(0.0, 0.0);
+            for (size_t n=begin; n<end; ++n) {sum += a[n];}
+            partial[worker] = sum;
+        }, 4096);
+        c mean(0.0, 0.0);
+        for (auto &p : partial) {mean += p;}
+        c twiceMean = 2.0*mean/(double)size;
+        parallelFor(size, [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t n=begin; n<end; ++n) {a[n] = m_sign > 0 ? twiceMean - a[n] : a[n] - twiceMean;}
+        }, 4096);
+        return;
+    }
+    // Subset: each block of amplitudes sharing the other qubits is reflected about its own mean
+    parallelFor(size/blockSize, [&](size_t begin, size_t end, unsigned)
+    {
+        size_t base = deposit(begin, outerMask);
+        for (size_t o=begin; o<end; ++o)
+        {
+            c sum(0.0, 0.0);
+            size_t sub = 0;
+            do {
+                sum += a[base | sub];
+                sub = (sub - mask) & mask;
+            } while (sub != 0);
+            c twiceMean = 2.0*sum/(double)blockSize;
+            do {
+                a[base | sub] = m_sign > 0 ? twiceMean - a[base | sub] : a[base | sub] - twiceMean;
+                sub = (sub - mask) & mask;
+            } while (sub != 0);
+            base = (base - outerMask) & outerMask;
+        }
+    }, std::max<size_t>(1, 4096/blockSize));
+}
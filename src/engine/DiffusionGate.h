@@ -0,0 +1,23 @@
+#ifndef DiffusionGate_H
+#define DiffusionGate_H
+
+#include "Gate.h"
+
+// Grover diffusion 2|s><s| - I over a subset of qubits, i.e. every amplitude is reflected
+// about the mean of its block. One parallel reduction for the means, one update pass.
+class DiffusionGate : public Gate
+{
+public:
+	DiffusionGate(std::vector<int> qubits, double sign = 1.0);
+	void act(Qregister &qregister);
+	std::vector<int> qubits() {return m_qubits;}
+	double sign() {return m_sign;}
+	std::string key() {std::string k = Gate::key(); appendKey(k, m_sign); return k;}
+	void remap(const std::vector<int> &map);
+protected:
+	std::vector<int> m_qubits;
+	size_t m_mask;
+	double m_sign;
+};
+
+#endif
@@ -0,0 +1,556 @@
+#ifdef QATCH_MPI
+
+#include "Distributed.h"
+#include "CustomGate.h"
+#include "QftGate.h"
+#include "DiagonalGate.h"
+#include "DefaultGate.h"
+#include "DiffusionGate.h"
+#include "MatrixKernel.h"
+#include "Reduction.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <stdexcept>
+
+typedef std::complex<double> c;
+
+// Widest chunk a process will allocate, as for the dense backend
+static const int MAX_LOCAL_QUBITS = 40;
+// Amplitudes per message, and messages in flight while the next block is packed
+static const size_t EXCHANGE_BLOCK = size_t(1) << 16;
+static const size_t EXCHANGE_WINDOW = 4;
+// Gates scanned ahead when choosing which local qubit to give up
+static const size_t LOOKAHEAD = 1024;
+// Amplitudes per message when gathering the output
+static const size_t GATHER_BLOCK = size_t(1) << 26;
+
+// Textbook circuit of the transform, most significant qubit first and the reversal at the end.
+// The inverse runs the same gates backwards with conjugate phases.
+static std::vector<std::unique_ptr<Gate>> qftCircuit(QftGate &qft)
+{
+    const double pi = std::acos(-1.0);
+    int low = qft.lowQubit();
+    int high = qft.highQubit();
+    double sign = qft.isInverse() ? -1.0 : 1.0;
+    std::vector<std::unique_ptr<Gate>> circuit;
+    for (int j=high; j>=low; --j)
+    {
+        circuit.push_back(std::make_unique<HadamardGate>(j));
+        for (int k=j-1; k>=low; --k)
+        {
+            circuit.push_back(std::make_unique<PhaseShiftGate>(j, sign*pi/std::ldexp(1.0, j-k), std::vector<int>{k}));
+        }
+    }
+    for (int j=low, k=high; j<k; ++j, --k)
+    {
+        circuit.push_back(std::make_unique<SwapGate>(j, k));
+    }
+    if (qft.isInverse()) {std::reverse(circuit.begin(), circuit.end());}
+    return circuit;
+}
+
+int DistributedRegister::rank()
+{
+    int r = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &r);
+    return r;
+}
+
+int DistributedRegister::processes()
+{
+    int p = 1;
+    MPI_Comm_size(MPI_COMM_WORLD, &p);
+    return p;
+}
+
+// Rounded up, reset() refuses a count that is not a power of two
+int DistributedRegister::globalQubits()
+{
+    int g = 0;
+    while ((1 << g) < processes()) {++g;}
+    return g;
+}
+
+// Diagonal gates, diffusions, uncontrolled swaps and global controls need no local qubit and a
+// QFT wider than the chunk runs as its H + CP + SWAP circuit
+int DistributedRegister::localQubitsNeeded(Gate &gate)
+{
+    if (CustomGate *custom = dynamic_cast<CustomGate*>(&gate))
+    {
+        int needed = 0;
+        for (auto &sub : custom->gates())
+        {
+            needed = std::max(needed, localQubitsNeeded(*sub));
+        }
+        return needed;
+    }
+    if (dynamic_cast<DiagonalGate*>(&gate) || dynamic_cast<DiffusionGate*>(&gate)) {return 0;}
+    if (SwapGate *swap = dynamic_cast<SwapGate*>(&gate)) {return swap->controlQubits().empty() ? 0 : 2;}
+    if (MatrixGate *matrixGate = dynamic_cast<MatrixGate*>(&gate)) {return matrixGate->isDiagonal() ? 0 : 1;}
+    if (dynamic_cast<DefaultGate*>(&gate)) {return 1;}
+    if (dynamic_cast<QftGate*>(&gate)) {return 1;}
+    return (int)gate.qubits().size();
+}
+
+bool DistributedRegister::splits(int numQubits, const std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    int needed = 1;
+    for (auto &gate : gateList)
+    {
+        needed = std::max(needed, localQubitsNeeded(*gate));
+    }
+    return numQubits - globalQubits() >= needed;
+}
+
+void DistributedRegister::reset(int numQubits, const std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    int p = processes();
+    int globalQubits = DistributedRegister::globalQubits();
+    if ((1 << globalQubits) != p)
+    {
+        throw std::runtime_error("The distributed backend needs a power of two processes, not "+std::to_string(p));
+    }
+    m_numQubits = numQubits;
+    m_localQubits = numQubits - globalQubits;
+    if (m_localQubits < 1 || m_localQubits > MAX_LOCAL_QUBITS)
+    {
+        throw std::runtime_error("A register of "+std::to_string(numQubits)+" qubits cannot be split over "+std::to_string(p)+" processes");
+    }
+    m_rank = rank();
+    m_exchanges = 0;
+    // The qubits used least often start in the global positions
+    std::vector<size_t> uses(numQubits, 0);
+    for (auto &gate : gateList)
+    {
+        for (int q : gate->qubits())
+        {
+            ++uses[q-1];
+        }
+    }
+    std::vector<int> order(numQubits);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {return uses[a] > uses[b];});
+    m_physical.assign(numQubits, 0);
+    m_logical = order;
+    for (int b=0; b<numQubits; ++b)
+    {
+        m_physical[order[b]] = b;
+    }
+    resetRegister(m_local, size_t(1) << m_localQubits);
+    if (m_rank != 0) {m_local[0] = c(0.0, 0.0);}
+}
+
+void DistributedRegister::run(std::vector<std::unique_ptr<Gate>> &gateList, size_t first, size_t last)
+{
+    for (size_t i=first; i<last; ++i)
+    {
+        if (gateList[i]->isCheckpoint()) {continue;}
+        apply(*gateList[i], gateList, i+1);
+    }
+}
+
+// Runs the gate on the local chunk with its qubits relabelled to their physical bits
+void DistributedRegister::apply(Gate &gate, const std::vector<std::unique_ptr<Gate>> &gateList, size_t next)
+{
+    if (CustomGate *custom = dynamic_cast<CustomGate*>(&gate))
+    {
+        for (auto &sub : custom->gates())
+        {
+            apply(*sub, gateList, next);
+        }
+        return;
+    }
+    std::vector<int> bits;
+    for (int q : gate.qubits())
+    {
+        bits.push_back(q-1);
+    }
+    bool global = false;
+    for (int b : bits)
+    {
+        global = global || m_physical[b] >= m_localQubits;
+    }
+    if (global && applyDiagonal(gate)) {return;}
+    DiffusionGate *diffusion = dynamic_cast<DiffusionGate*>(&gate);
+    if (diffusion && (int)bits.size() > m_localQubits)
+    {
+        applyWideDiffusion(bits, diffusion->sign());
+        return;
+    }
+    if (DefaultGate *defaultGate = dynamic_cast<DefaultGate*>(&gate))
+    {
+        applyControlled(*defaultGate, gateList, next);
+        return;
+    }
+    QftGate *qft = dynamic_cast<QftGate*>(&gate);
+    if (qft && (int)bits.size() > m_localQubits)
+    {
+        for (auto &sub : qftCircuit(*qft))
+        {
+            apply(*sub, gateList, next);
+        }
+        return;
+    }
+    if ((int)bits.size() > m_localQubits)
+    {
+        throw std::runtime_error("Gate '"+gate.name()+"' on "+std::to_string(bits.size())+" qubits does not fit the "
+            +std::to_string(m_localQubits)+" local qubits of each process");
+    }
+    // The transform kernel needs its range contiguous and in order
+    if (qft) {placeInOrder(bits);}
+    else {makeLocal(bits, gateList, next);}
+    std::vector<int> map(m_numQubits+1, 0);
+    std::vector<int> inverse(m_numQubits+1, 0);
+    for (int q=1; q<=m_numQubits; ++q)
+    {
+        map[q] = m_physical[q-1]+1;
+        inverse[map[q]] = q;
+    }
+    gate.remap(map);
+    gate.act(m_local);
+    gate.remap(inverse);
+}
+
+// Only the targets are moved into the chunk. A global control is fixed by the rank, the gate
+// is skipped where it is 0 and runs on the remaining controls where it is 1.
+void DistributedRegister::applyControlled(DefaultGate &gate, const std::vector<std::unique_ptr<Gate>> &gateList, size_t next)
+{
+    SwapGate *swap = dynamic_cast<SwapGate*>(&gate);
+    std::vector<int> targets = {gate.activeQubit()-1};
+    if (swap) {targets.push_back(swap->swapQubit()-1);}
+    std::vector<int> controls = gate.controlQubits();
+    if (swap && controls.empty())
+    {
+        int a = m_physical[targets[0]];
+        int b = m_physical[targets[1]];
+        m_physical[targets[0]] = b;
+        m_physical[targets[1]] = a;
+        m_logical[a] = targets[1];
+        m_logical[b] = targets[0];
+        return;
+    }
+    makeLocal(targets, gateList, next);
+    std::vector<int> controlBits;
+    for (int cq : controls)
+    {
+        int p = m_physical[cq-1];
+        if (p < m_localQubits) {controlBits.push_back(p);}
+        else if (!((m_rank >> (p - m_localQubits)) & 1)) {return;}
+    }
+    if (swap)
+    {
+        applySwap(m_local, m_physical[targets[0]], m_physical[targets[1]], controlBits);
+        return;
+    }
+    std::vector<c> matrix = static_cast<MatrixGate&>(gate).matrix();
+    applyMatrix(m_local, matrix.data(), m_physical[targets[0]], controlBits);
+}
+
+// Phases of a diagonal gate with the global bits of this rank substituted, false for other gates
+bool DistributedRegister::applyDiagonal(Gate &gate)
+{
+    std::vector<DiagonalTerm> terms;
+    MatrixGate *matrixGate = dynamic_cast<MatrixGate*>(&gate);
+    if (DiagonalGate *diagonal = dynamic_cast<DiagonalGate*>(&gate))
+    {
+        terms = diagonal->terms();
+    } else if (matrixGate && matrixGate->isDiagonal()) {
+        size_t controlMask = 0;
+        for (int cq : matrixGate->controlQubits())
+        {
+            controlMask |= size_t(1) << (cq-1);
+        }
+        std::vector<c> m = matrixGate->matrix();
+        terms.push_back({controlMask, size_t(1) << (matrixGate->activeQubit()-1), m[0], m[3]});
+    } else {
+        return false;
+    }
+    auto physicalMask = [&](size_t mask)
+    {
+        size_t result = 0;
+        for (int b=0; mask; ++b, mask>>=1)
+        {
+            if (mask & 1) {result |= size_t(1) << m_physical[b];}
+        }
+        return result;
+    };
+    size_t localMask = (size_t(1) << m_localQubits) - 1;
+    size_t rankBits = size_t(m_rank) << m_localQubits;
+    std::vector<DiagonalTerm> local;
+    for (auto &t : terms)
+    {
+        size_t control = physicalMask(t.controlMask);
+        size_t active = physicalMask(t.activeBit);
+        if ((control & rankBits) != (control & ~localMask)) {continue;}
+        control &= localMask;
+        if (active & localMask)
+        {
+            local.push_back({control, active, t.d0, t.d1});
+            continue;
+        }
+        // The phase is fixed on this rank, it only depends on the remaining local controls
+        c phase = (active & rankBits) ? t.d1 : t.d0;
+        if (control == 0)
+        {
+            local.push_back({0, 1, phase, phase});
+        } else {
+            size_t bit = control & (~control + 1);
+            local.push_back({control ^ bit, bit, c(1.0, 0.0), phase});
+        }
+    }
+    if (!local.empty()) {DiagonalGate(local).act(m_local);}
+    return true;
+}
+
+// Every local bit is made one of the reflected bits, so each rank contributes one partial sum
+// to the ranks that share its other global bits
+void DistributedRegister::applyWideDiffusion(const std::vector<int> &bits, double sign)
+{
+    std::vector<bool> reflected(m_numQubits, false);
+    for (int b : bits)
+    {
+        reflected[b] = true;
+    }
+    int spare = m_numQubits;
+    for (int p=0; p<m_localQubits; ++p)
+    {
+        if (reflected[m_logical[p]]) {continue;}
+        while (!reflected[m_logical[--spare]]) {}
+        swapPhysical(p, spare);
+    }
+    int groupMask = 0;
+    for (int b : bits)
+    {
+        if (m_physical[b] >= m_localQubits) {groupMask |= 1 << (m_physical[b] - m_localQubits);}
+    }
+    std::vector<c> partial(parallelWorkers(), c(0.0, 0.0));
+    parallelFor(m_local.size(), [&](size_t begin, size_t end, unsigned worker)
+    {
+        c sum(0.0, 0.0);
+        for (size_t n=begin; n<end; ++n) {sum += m_local[n];}
+        partial[worker] = sum;
+    }, 4096);
+    c sum(0.0, 0.0);
+    for (auto &p : partial) {sum += p;}
+    MPI_Comm group;
+    MPI_Comm_split(MPI_COMM_WORLD, m_rank & ~groupMask, m_rank, &group);
+    MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_C_DOUBLE_COMPLEX, MPI_SUM, group);
+    MPI_Comm_free(&group);
+    c twiceMean = 2.0*sum/std::ldexp(1.0, bits.size());
+    parallelFor(m_local.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t n=begin; n<end; ++n) {m_local[n] = sign > 0 ? twiceMean - m_local[n] : m_local[n] - twiceMean;}
+    }, 4096);
+}
+
+void DistributedRegister::makeLocal(const std::vector<int> &bits, const std::vector<std::unique_ptr<Gate>> &gateList, size_t next)
+{
+    std::vector<size_t> nextUse;
+    for (int b : bits)
+    {
+        if (m_physical[b] < m_localQubits) {continue;}
+        if (nextUse.empty())
+        {
+            nextUse.assign(m_numQubits, SIZE_MAX);
+            for (size_t i=next; i<gateList.size() && i<next+LOOKAHEAD; ++i)
+            {
+                for (int q : gateList[i]->qubits())
+                {
+                    nextUse[q-1] = std::min(nextUse[q-1], i);
+                }
+            }
+        }
+        int victim = -1;
+        for (int p=m_localQubits-1; p>=0; --p)
+        {
+            int l = m_logical[p];
+            if (std::find(bits.begin(), bits.end(), l) != bits.end()) {continue;}
+            if (victim < 0 || nextUse[l] > nextUse[m_logical[victim]]) {victim = p;}
+        }
+        swapPhysical(victim, m_physical[b]);
+    }
+}
+
+// Puts the bits on physical bits 0, 1, ... unless they already are contiguous and ordered
+void DistributedRegister::placeInOrder(const std::vector<int> &bits)
+{
+    int base = m_physical[bits[0]];
+    bool ordered = (base + (int)bits.size() <= m_localQubits);
+    for (size_t j=0; j<bits.size() && ordered; ++j)
+    {
+        ordered = (m_physical[bits[j]] == base + (int)j);
+    }
+    if (ordered) {return;}
+    for (size_t j=0; j<bits.size(); ++j)
+    {
+        swapPhysical(m_physical[bits[j]], j);
+    }
+}
+
+void DistributedRegister::swapPhysical(int a, int b)
+{
+    if (a == b) {return;}
+    if (a > b) {std::swap(a, b);}
+    if (b < m_localQubits)
+    {
+        applySwap(m_local, a, b, {});
+    } else if (a < m_localQubits) {
+        exchange(a, b);
+    } else {
+        // Two global bits trade places through local bit 0
+        exchange(0, a);
+        exchange(0, b);
+        exchange(0, a);
+    }
+    int la = m_logical[a];
+    int lb = m_logical[b];
+    m_logical[a] = lb;
+    m_logical[b] = la;
+    m_physical[la] = b;
+    m_physical[lb] = a;
+}
+
+// Swaps a local and a global bit. This rank keeps the half of its chunk whose local bit
+// equals its global bit and trades the other half with the partner, block by block, so
+// packing and unpacking overlap with the messages in flight.
+void DistributedRegister::exchange(int localBit, int globalBit)
+{
+    int shift = globalBit - m_localQubits;
+    int partner = m_rank ^ (1 << shift);
+    size_t traded = ((m_rank >> shift) & 1) ^ 1;
+    size_t half = m_local.size()/2;
+    size_t block = std::min(EXCHANGE_BLOCK, half);
+    size_t blocks = half/block;
+    m_sendBuffer.resize(EXCHANGE_WINDOW*block);
+    m_receiveBuffer.resize(EXCHANGE_WINDOW*block);
+    MPI_Request requests[2*EXCHANGE_WINDOW];
+    size_t low = (size_t(1) << localBit) - 1;
+    auto index = [&](size_t i) {return ((i & ~low) << 1) | (traded << localBit) | (i & low);};
+    auto finish = [&](size_t k)
+    {
+        size_t slot = k % EXCHANGE_WINDOW;
+        MPI_Waitall(2, requests + 2*slot, MPI_STATUSES_IGNORE);
+        const c *in = m_receiveBuffer.data() + slot*block;
+        parallelFor(block, [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i=begin; i<end; ++i) {m_local[index(k*block + i)] = in[i];}
+        }, 1 << 14);
+    };
+    for (size_t k=0; k<blocks; ++k)
+    {
+        if (k >= EXCHANGE_WINDOW) {finish(k - EXCHANGE_WINDOW);}
+        size_t slot = k % EXCHANGE_WINDOW;
+        c *out = m_sendBuffer.data() + slot*block;
+        parallelFor(block, [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i=begin; i<end; ++i) {out[i] = m_local[index(k*block + i)];}
+        }, 1 << 14);
+        MPI_Irecv(m_receiveBuffer.data() + slot*block, (int)block, MPI_C_DOUBLE_COMPLEX, partner, (int)slot, MPI_COMM_WORLD, &requests[2*slot]);
+        MPI_Isend(out, (int)block, MPI_C_DOUBLE_COMPLEX, partner, (int)slot, MPI_COMM_WORLD, &requests[2*slot+1]);
+    }
+    for (size_t k=(blocks > EXCHANGE_WINDOW ? blocks - EXCHANGE_WINDOW : 0); k<blocks; ++k)
+    {
+        finish(k);
+    }
+    ++m_exchanges;
+}
+
+void DistributedRegister::restoreLayout()
+{
+    for (int b=0; b<m_numQubits; ++b)
+    {
+        swapPhysical(m_physical[b], b);
+    }
+}
+
+void DistributedRegister::gather(Qregister &qregister)
+{
+    restoreLayout();
+    size_t chunk = m_local.size();
+    if (m_rank != 0)
+    {
+        for (size_t offset=0; offset<chunk; offset+=GATHER_BLOCK)
+        {
+            int count = (int)std::min(GATHER_BLOCK, chunk - offset);
+            MPI_Send(m_local.data() + offset, count, MPI_C_DOUBLE_COMPLEX, 0, 0, MPI_COMM_WORLD);
+        }
+        Qregister().swap(qregister);
+        return;
+    }
+    resetRegister(qregister, chunk*processes());
+    std::copy(m_local.begin(), m_local.end(), qregister.begin());
+    for (int r=1; r<processes(); ++r)
+    {
+        for (size_t offset=0; offset<chunk; offset+=GATHER_BLOCK)
+        {
+            int count = (int)std::min(GATHER_BLOCK, chunk - offset);
+            MPI_Recv(qregister.data() + r*chunk + offset, count, MPI_C_DOUBLE_COMPLEX, r, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+    }
+}
+
+// A requested bit is either local, and summed over in the chunk, or global and fixed by the
+// rank, so each rank adds its partial sums into its own slots of the result
+std::vector<double> DistributedRegister::marginal(const std::vector<int> &bits)
+{
+    std::vector<int> localBits;
+    std::vector<size_t> localSlots;
+    size_t rankSlots = 0;
+    for (size_t j=0; j<bits.size(); ++j)
+    {
+        int p = m_physical[bits[j]];
+        if (p < m_localQubits)
+        {
+            localBits.push_back(p);
+            localSlots.push_back(size_t(1) << j);
+        } else if ((m_rank >> (p - m_localQubits)) & 1) {
+            rankSlots |= size_t(1) << j;
+        }
+    }
+    std::vector<double> partial = marginalProbabilities(m_local, localBits);
+    std::vector<double> result(size_t(1) << bits.size(), 0.0);
+    for (size_t k=0; k<partial.size(); ++k)
+    {
+        size_t slot = rankSlots;
+        for (size_t j=0; j<localSlots.size(); ++j)
+        {
+            if ((k >> j) & 1) {slot |= localSlots[j];}
+        }
+        result[slot] = partial[k];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, result.data(), (int)result.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return result;
+}
+
+// Tracing out the global bits is the sum of the per-process matrices. More bits than a chunk
+// holds give a matrix at least as large as the register, which is then gathered on rank 0
+std::vector<c> DistributedRegister::reducedDensityMatrix(const std::vector<int> &bits)
+{
+    if ((int)bits.size() > m_localQubits)
+    {
+        if (m_numQubits > MAX_LOCAL_QUBITS) {throw std::runtime_error("Too many qubits for a distributed density matrix");}
+        Qregister whole;
+        gather(whole);
+        std::vector<c> result(size_t(1) << (2*bits.size()));
+        if (m_rank == 0) {result = ::reducedDensityMatrix(whole, bits);}
+        for (size_t offset=0; offset<result.size(); offset+=GATHER_BLOCK)
+        {
+            int count = (int)std::min(GATHER_BLOCK, result.size() - offset);
+            MPI_Bcast(result.data() + offset, count, MPI_C_DOUBLE_COMPLEX, 0, MPI_COMM_WORLD);
+        }
+        return result;
+    }
+    makeLocal(bits, {}, 0);
+    std::vector<int> physical;
+    for (int b : bits)
+    {
+        physical.push_back(m_physical[b]);
+    }
+    std::vector<c> result = ::reducedDensityMatrix(m_local, physical);
+    MPI_Allreduce(MPI_IN_PLACE, result.data(), (int)result.size(), MPI_C_DOUBLE_COMPLEX, MPI_SUM, MPI_COMM_WORLD);
+    return result;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef Distributed_H
+#define Distributed_H
+
+#ifdef QATCH_MPI
+
+#include "Gate.h"
+#include "DefaultGate.h"
+#include <mpi.h>
+
+typedef std::complex<double> c;
+
+// Register split over the 2^g processes of MPI_COMM_WORLD. The low n-g physical bits index
+// the local chunk, the high g bits the rank. Gates run on the chunk after their qubits have
+// been swapped into local positions, a swap with a global bit exchanges half of the chunk
+// with the partner rank. The logical to physical layout is kept between gates, and the local
+// qubit given up is the one whose next use lies furthest ahead. Diagonal gates never
+// communicate, their global bits are fixed by the rank, and neither do global controls or
+// uncontrolled swaps, which only relabel the layout. A diffusion wider than the chunk reflects
+// about a mean summed over the ranks it spans and a wider QFT runs as its H + CP + SWAP circuit.
+class DistributedRegister
+{
+public:
+    static int rank();
+    static int processes();
+    // Whether each chunk of the register has the local qubits every gate of the list needs
+    static bool splits(int numQubits, const std::vector<std::unique_ptr<Gate>> &gateList);
+    void reset(int numQubits, const std::vector<std::unique_ptr<Gate>> &gateList);
+    // Applies gates [first, last), every process passes the same list
+    void run(std::vector<std::unique_ptr<Gate>> &gateList, size_t first, size_t last);
+    // Physical bit b holds logical bit b again
+    void restoreLayout();
+    // The whole register on rank 0 in logical order, empty elsewhere
+    void gather(Qregister &qregister);
+    // Collective versions of the reductions in Reduction.h, the result is on every process
+    std::vector<double> marginal(const std::vector<int> &bits);
+    std::vector<c> reducedDensityMatrix(const std::vector<int> &bits);
+    size_t exchanges() const {return m_exchanges;}
+private:
+    static int globalQubits();
+    static int localQubitsNeeded(Gate &gate);
+    void apply(Gate &gate, const std::vector<std::unique_ptr<Gate>> &gateList, size_t next);
+    void makeLocal(const std::vector<int> &bits, const std::vector<std::unique_ptr<Gate>> &gateList, size_t next);
+    void placeInOrder(const std::vector<int> &bits);
+    bool applyDiagonal(Gate &gate);
+    void applyControlled(DefaultGate &gate, const std::vector<std::unique_ptr<Gate>> &gateList, size_t next);
+    void applyWideDiffusion(const std::vector<int> &bits, double sign);
+    void swapPhysical(int a, int b);
+    void exchange(int localBit, int globalBit);
+
+    int m_numQubits = 0;
+    int m_localQubits = 0;
+    int m_rank = 0;
+    // m_physical[logical bit] and its inverse m_logical[physical bit]
+    std::vector<int> m_physical;
+    std::vector<int> m_logical;
+    Qregister m_local;
+    std::vector<c> m_sendBuffer;
+    std::vector<c> m_receiveBuffer;
+    size_t m_exchanges = 0;
+};
+
+#endif
+
+#endif
\ No newline at end of file
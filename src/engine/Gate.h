@@ -5,15 +5,48 @@
 #include<string>
 #include<memory>
 #include<complex>
+#include<random>
+#include<cstdint>
+#include "Register.h"
 
 typedef std::complex<double> c;
 
+class SparseRegister;
+
 class Gate
 {
 public:
-	virtual void act(std::vector<c> &qregister) = 0;
+	virtual void act(Qregister &qregister) = 0;
+	// Monte Carlo trajectory step, noise channels sample a Kraus operator from rng
+	virtual void actTrajectory(Qregister &qregister, std::mt19937_64 &) {act(qregister);}
+	// Acts on a sparse register, false if the gate only has a dense kernel
+	virtual bool actSparse(SparseRegister &) {return false;}
+	virtual bool isNoisy() {return false;}
+	virtual bool isCheckpoint() {return false;}
+	virtual bool isDiagonal() {return false;}
+	// Every qubit the gate reads or writes, including controls
+	virtual std::vector<int> qubits() = 0;
+	// Relabels every qubit q as map[q]
+	virtual void remap(const std::vector<int> &map) = 0;
+	// Bytes that identify the action on the register, equal keys mean equal gates
+	virtual std::string key()
+	{
+		std::string k = m_name;
+		k.push_back('\0');
+		appendKey(k, qubits());
+		return k;
+	}
 	std::string name() {return m_name;}
 protected:
+	template<class T> static void appendKey(std::string &key, const T &value)
+	{
+		key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	template<class T> static void appendKey(std::string &key, const std::vector<T> &values)
+	{
+		appendKey(key, uint64_t(values.size()));
+		key.append(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+	}
 	std::string m_name;
 };
 
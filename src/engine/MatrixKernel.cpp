@@ -0,0 +1,175 @@
+#include "MatrixKernel.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <array>
+#include <utility>
+
+typedef std::complex<double> c;
+
+// Targets below this bit get a kernel whose inner loop runs over a fixed number of contiguous pairs
+static const int LOW_TARGETS = 4;
+static const int MAX_CONTROLS = 3;
+static const size_t MIN_CHUNK = 1 << 12;
+
+// Index of the i-th block with every one of the N sorted bits cleared
+template<int N>
+static inline size_t insertZeros(size_t i, const int *sortedBits)
+{
+    for (int j=0; j<N; ++j)
+    {
+        size_t low = i & ((size_t(1) << sortedBits[j]) - 1);
+        i = ((i >> sortedBits[j]) << (sortedBits[j]+1)) | low;
+    }
+    return i;
+}
+
+static inline void rotate(c &a0, c &a1, const c *m)
+{
+    c x = a0;
+    c y = a1;
+    a0 = m[0]*x + m[1]*y;
+    a1 = m[2]*x + m[3]*y;
+}
+
+// C controls, all above the target when T < LOW_TARGETS. The block of the low T+1 bits is then
+// contiguous, so the pairs inside it are walked by a fixed-length loop the compiler unrolls.
+// T == LOW_TARGETS is the runtime target case, where the target bit is inserted like a control.
+template<int C, int T>
+static void matrixKernel(Qregister &qregister, const c *matrix, int targetBit, const int *controlBits)
+{
+    const c m[4] = {matrix[0], matrix[1], matrix[2], matrix[3]};
+    size_t controlMask = 0;
+    for (int j=0; j<C; ++j)
+    {
+        controlMask |= size_t(1) << controlBits[j];
+    }
+    c *a = qregister.data();
+    if (T < LOW_TARGETS)
+    {
+        const size_t PAIRS = size_t(1) << T;
+        std::array<int, C+1> bits;
+        for (int j=0; j<C; ++j) {bits[j] = controlBits[j] - (T+1);}
+        std::sort(bits.begin(), bits.begin()+C);
+        parallelFor(qregister.size() >> (T+1+C), [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i=begin; i<end; ++i)
+            {
+                size_t base = (insertZeros<C>(i, bits.data()) << (T+1)) | controlMask;
+                for (size_t j=0; j<PAIRS; ++j)
+                {
+                    rotate(a[base + j], a[base + j + PAIRS], m);
+                }
+            }
+        }, std::max<size_t>(1, MIN_CHUNK >> (T+1)));
+        return;
+    }
+    const size_t stride = size_t(1) << targetBit;
+    std::array<int, C+1> bits;
+    for (int j=0; j<C; ++j) {bits[j] = controlBits[j];}
+    bits[C] = targetBit;
+    std::sort(bits.begin(), bits.end());
+    parallelFor(qregister.size() >> (C+1), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            size_t n = insertZeros<C+1>(i, bits.data()) | controlMask;
+            rotate(a[n], a[n + stride], m);
+        }
+    }, MIN_CHUNK);
+}
+
+// Any number of controls in any position
+static void matrixKernelGeneric(Qregister &qregister, const c *matrix, int targetBit, const std::vector<int> &controlBits)
+{
+    const c m[4] = {matrix[0], matrix[1], matrix[2], matrix[3]};
+    size_t controlMask = 0;
+    for (int cb : controlBits)
+    {
+        controlMask |= size_t(1) << cb;
+    }
+    std::vector<int> bits = controlBits;
+    bits.push_back(targetBit);
+    std::sort(bits.begin(), bits.end());
+    const size_t stride = size_t(1) << targetBit;
+    c *a = qregister.data();
+    parallelFor(qregister.size() >> bits.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            size_t n = i;
+            for (int b : bits)
+            {
+                n = ((n >> b) << (b+1)) | (n & ((size_t(1) << b) - 1));
+            }
+            n |= controlMask;
+            rotate(a[n], a[n + stride], m);
+        }
+    }, MIN_CHUNK);
+}
+
+typedef void (*MatrixKernel)(Qregister &, const c *, int, const int *);
+
+template<int C, size_t... T>
+static constexpr std::array<MatrixKernel, LOW_TARGETS+1> kernelRow(std::index_sequence<T...>)
+{
+    return {{&matrixKernel<C, int(T)>...}};
+}
+
+template<size_t... C>
+static constexpr std::array<std::array<MatrixKernel, LOW_TARGETS+1>, MAX_CONTROLS+1> kernelTable(std::index_sequence<C...>)
+{
+    return {{kernelRow<int(C)>(std::make_index_sequence<LOW_TARGETS+1>())...}};
+}
+
+// Indexed by [control count][target bit], the last column takes any target
+static constexpr auto KERNELS = kernelTable(std::make_index_sequence<MAX_CONTROLS+1>());
+
+void applyMatrix(Qregister &qregister, const c *matrix, int targetBit, const std::vector<int> &controlBits)
+{
+    int numControls = controlBits.size();
+    if (numControls > MAX_CONTROLS)
+    {
+        matrixKernelGeneric(qregister, matrix, targetBit, controlBits);
+        return;
+    }
+    int column = LOW_TARGETS;
+    if (targetBit < LOW_TARGETS)
+    {
+        column = targetBit;
+        for (int cb : controlBits)
+        {
+            if (cb < targetBit) {column = LOW_TARGETS;}
+        }
+    }
+    KERNELS[numControls][column](qregister, matrix, targetBit, controlBits.data());
+}
+
+void applySwap(Qregister &qregister, int bit1, int bit2, const std::vector<int> &controlBits)
+{
+    if (bit1 == bit2) {return;}
+    size_t controlMask = 0;
+    for (int cb : controlBits)
+    {
+        controlMask |= size_t(1) << cb;
+    }
+    std::vector<int> bits = controlBits;
+    bits.push_back(bit1);
+    bits.push_back(bit2);
+    std::sort(bits.begin(), bits.end());
+    const size_t b1 = size_t(1) << bit1;
+    const size_t b2 = size_t(1) << bit2;
+    c *a = qregister.data();
+    parallelFor(qregister.size() >> bits.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i=begin; i<end; ++i)
+        {
+            size_t n = i;
+            for (int b : bits)
+            {
+                n = ((n >> b) << (b+1)) | (n & ((size_t(1) << b) - 1));
+            }
+            n |= controlMask;
+            std::swap(a[n | b1], a[n | b2]);
+        }
+    }, MIN_CHUNK);
+}
\ No newline at end of file
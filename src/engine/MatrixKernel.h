@@ -0,0 +1,15 @@
+#ifndef MatrixKernel_H
+#define MatrixKernel_H
+
+#include "Register.h"
+#include <complex>
+#include <vector>
+
+// Applies a 2x2 matrix {m00, m01, m10, m11} to the target bit wherever every control bit is set.
+// Bits are 0-based register positions, the matrix and the control list are read in place.
+void applyMatrix(Qregister &qregister, const std::complex<double> *matrix, int targetBit, const std::vector<int> &controlBits);
+
+// Swaps the two bits wherever every control bit is set
+void applySwap(Qregister &qregister, int bit1, int bit2, const std::vector<int> &controlBits);
+
+#endif
\ No newline at end of file
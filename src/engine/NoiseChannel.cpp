@@ -0,0 +1,93 @@
+#include "NoiseChannel.h"
+
+typedef std::complex<double> c;
+
+static void applyPauli(Qregister &qregister, int activeQubit, int pauli)
+{
+    size_t bit = size_t(1) << (activeQubit-1);
+    for (size_t n=0; n<qregister.size(); ++n)
+    {
+        if (n & bit) {continue;}
+        c a0 = qregister[n];
+        c a1 = qregister[n | bit];
+        switch (pauli)
+        {
+            case 0 : qregister[n] = a1;             qregister[n | bit] = a0; break;
+            case 1 : qregister[n] = c(0.0,-1.0)*a1; qregister[n | bit] = c(0.0,1.0)*a0; break;
+            case 2 : qregister[n | bit] = -a1; break;
+        }
+    }
+}
+
+void NoiseChannel::act(Qregister &)
+{
+    ;
+}
+
+DepolarizingChannel::DepolarizingChannel(int activeQubit, double probability)
+{
+    m_name = "DEPOL";
+    m_activeQubit = activeQubit;
+    m_probability = probability;
+}
+void DepolarizingChannel::actTrajectory(Qregister &qregister, std::mt19937_64 &rng)
+{
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    if (u(rng) < m_probability)
+    {
+        std::uniform_int_distribution<int> pauli(0, 2);
+        applyPauli(qregister, m_activeQubit, pauli(rng));
+    }
+}
+
+AmplitudeDampingChannel::AmplitudeDampingChannel(int activeQubit, double gamma)
+{
+    m_name = "DAMP";
+    m_activeQubit = activeQubit;
+    m_probability = gamma;
+}
+void AmplitudeDampingChannel::actTrajectory(Qregister &qregister, std::mt19937_64 &rng)
+{
+    size_t bit = size_t(1) << (m_activeQubit-1);
+    double excited = 0;
+    for (size_t n=0; n<qregister.size(); ++n)
+    {
+        if (n & bit) {excited += std::norm(qregister[n]);}
+    }
+    double pJump = m_probability*excited;
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    if (u(rng) < pJump)
+    {
+        // K1 = sqrt(gamma)|0><1|, renormalised
+        double scale = 1.0/std::sqrt(excited);
+        for (size_t n=0; n<qregister.size(); ++n)
+        {
+            if (n & bit) {continue;}
+            qregister[n] = qregister[n | bit]*scale;
+            qregister[n | bit] = c(0.0, 0.0);
+        }
+    } else {
+        // K0 = |0><0| + sqrt(1-gamma)|1><1|, renormalised
+        double scale = 1.0/std::sqrt(1.0 - pJump);
+        double damp = std::sqrt(1.0 - m_probability)*scale;
+        for (size_t n=0; n<qregister.size(); ++n)
+        {
+            qregister[n] *= (n & bit) ? damp : scale;
+        }
+    }
+}
+
+ReadoutErrorChannel::ReadoutErrorChannel(int activeQubit, double probability)
+{
+    m_name = "READOUT";
+    m_activeQubit = activeQubit;
+    m_probability = probability;
+}
+void ReadoutErrorChannel::actTrajectory(Qregister &qregister, std::mt19937_64 &rng)
+{
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    if (u(rng) < m_probability)
+    {
+        applyPauli(qregister, m_activeQubit, 0);
+    }
+}
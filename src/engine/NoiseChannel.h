@@ -0,0 +1,44 @@
+#ifndef NoiseChannel_H
+#define NoiseChannel_H
+
+#include "Gate.h"
+#include <cmath>
+
+// Single-qubit noise channel, ideal evolution leaves the register untouched and
+// trajectory evolution applies one randomly chosen Kraus operator
+class NoiseChannel : public Gate
+{
+public:
+	void act(Qregister &qregister);
+	bool isNoisy() {return true;}
+	std::vector<int> qubits() {return {m_activeQubit};}
+	std::string key() {std::string k = Gate::key(); appendKey(k, m_probability); return k;}
+	void remap(const std::vector<int> &map) {m_activeQubit = map[m_activeQubit];}
+protected:
+	int m_activeQubit;
+	double m_probability = 0;
+};
+
+class DepolarizingChannel : public NoiseChannel
+{
+public:
+	DepolarizingChannel(int activeQubit, double probability);
+	void actTrajectory(Qregister &qregister, std::mt19937_64 &rng);
+};
+
+class AmplitudeDampingChannel : public NoiseChannel
+{
+public:
+	AmplitudeDampingChannel(int activeQubit, double gamma);
+	void actTrajectory(Qregister &qregister, std::mt19937_64 &rng);
+};
+
+// Classical flip of the measured bit, the parser rejects gates after it on the same qubit
+class ReadoutErrorChannel : public NoiseChannel
+{
+public:
+	ReadoutErrorChannel(int activeQubit, double probability);
+	void actTrajectory(Qregister &qregister, std::mt19937_64 &rng);
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include "Optimiser.h"
+#include <algorithm>
+#include <iostream>
+
+typedef std::complex<double> c;
+
+static const double TOLERANCE = 1e-12;
+// Gates searched backwards for a partner to cancel or merge with
+static const int PEEPHOLE_WINDOW = 64;
+// Widest definition replaced by a dense unitary, and how many unitaries are remembered
+static const size_t MAX_COMPILED_QUBITS = 5;
+static const size_t MAX_COMPILED_ENTRIES = 4096;
+
+enum Basis {
+    BASIS_Z,
+    BASIS_X,
+    BASIS_OTHER
+};
+
+static bool isIdentity(const std::vector<c> &m)
+{
+    return std::abs(m[0] - 1.0) < TOLERANCE && std::abs(m[1]) < TOLERANCE
+        && std::abs(m[2]) < TOLERANCE && std::abs(m[3] - 1.0) < TOLERANCE;
+}
+
+static std::vector<c> multiply(const std::vector<c> &a, const std::vector<c> &b)
+{
+    return {a[0]*b[0] + a[1]*b[2], a[0]*b[1] + a[1]*b[3], a[2]*b[0] + a[3]*b[2], a[2]*b[1] + a[3]*b[3]};
+}
+
+static std::vector<int> sorted(std::vector<int> v)
+{
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+// Basis the gate acts in on qubit q: controls and diagonal targets act in Z, X-like targets (X, RX) in X
+static Basis basisOn(Gate *g, int q)
+{
+    if (g->isDiagonal()) {return BASIS_Z;}
+    DefaultGate *dg = dynamic_cast<DefaultGate*>(g);
+    if (!dg) {return BASIS_OTHER;}
+    std::vector<int> cqs = dg->controlQubits();
+    if (std::find(cqs.begin(), cqs.end(), q) != cqs.end()) {return BASIS_Z;}
+    MatrixGate *mg = dynamic_cast<MatrixGate*>(g);
+    if (!mg) {return BASIS_OTHER;}
+    std::vector<c> m = mg->matrix();
+    if (std::abs(m[0] - m[3]) < TOLERANCE && std::abs(m[1] - m[2]) < TOLERANCE) {return BASIS_X;}
+    return BASIS_OTHER;
+}
+
+Optimiser::Optimiser()
+{
+    m_level = 1;
+    m_removed = 0;
+}
+
+void Optimiser::setLevel(int level)
+{
+    m_level = level;
+}
+
+void Optimiser::optimise(std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    if (m_level < 1) {return;}
+    compileCustomGates(gateList);
+    inlineCustomGates(gateList);
+    substituteDiffusion(gateList);
+    peephole(gateList);
+    fuseDiagonals(gateList);
+}
+
+void Optimiser::report()
+{
+    if (m_removed > 0)
+    {
+        std::cerr<<"Optimiser (-O"<<m_level<<") removed "<<m_removed<<" gates"<<std::endl;
+    }
+}
+
+// Collects the gates a definition expands to, in order
+static void leafGates(Gate *gate, std::vector<Gate*> &leaves)
+{
+    CustomGate *cg = dynamic_cast<CustomGate*>(gate);
+    if (!cg)
+    {
+        leaves.push_back(gate);
+        return;
+    }
+    for (auto &g : cg->gates())
+    {
+        leafGates(g.get(), leaves);
+    }
+}
+
+// Replaces each noise-free definition on at most MAX_COMPILED_QUBITS qubits by its unitary, found
+// by running the body on every basis state of a register of just those qubits. Wider definitions
+// keep their body, where narrower nested definitions are compiled instead. Bodies the later passes
+// handle better are left to be inlined: all diagonal ones are fused into a DiagonalGate and ones
+// containing a diffusion reflection get the DiffusionGate kernel, which a dense unitary would hide.
+void Optimiser::compileCustomGates(std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    for (auto &g : gateList)
+    {
+        CustomGate *cg = dynamic_cast<CustomGate*>(g.get());
+        if (!cg || cg->isNoisy()) {continue;}
+        std::vector<int> qs = cg->qubits();
+        std::vector<Gate*> leaves;
+        leafGates(cg, leaves);
+        if (containsDiffusion(leaves)) {continue;}
+        if (qs.size() > MAX_COMPILED_QUBITS)
+        {
+            compileCustomGates(cg->gates());
+            continue;
+        }
+        bool checkpoint = false;
+        bool diagonal = true;
+        for (Gate *leaf : leaves)
+        {
+            checkpoint = checkpoint || leaf->isCheckpoint();
+            diagonal = diagonal && leaf->isDiagonal();
+        }
+        if (qs.empty() || leaves.size() < 2 || checkpoint || diagonal) {continue;}
+        // The lowest qubit becomes bit 0 of the local register
+        std::vector<int> local(qs.back()+1, 0);
+        for (size_t j=0; j<qs.size(); ++j)
+        {
+            local[qs[j]] = j+1;
+        }
+        cg->remap(local);
+        std::string key = cg->key();
+        auto it = m_compiled.find(key);
+        if (it == m_compiled.end())
+        {
+            size_t D = size_t(1) << qs.size();
+            std::vector<c> matrix(D*D);
+            Qregister basis(D);
+            for (size_t l=0; l<D; ++l)
+            {
+                std::fill(basis.begin(), basis.end(), c(0.0, 0.0));
+                basis[l] = c(1.0, 0.0);
+                cg->act(basis);
+                for (size_t r=0; r<D; ++r)
+                {
+                    matrix[r*D + l] = basis[r];
+                }
+            }
+            if (m_compiled.size() >= MAX_COMPILED_ENTRIES) {m_compiled.clear();}
+            it = m_compiled.emplace(key, matrix).first;
+        }
+        // UnitaryGate takes its first qubit as the most significant bit
+        g = std::make_unique<UnitaryGate>(std::vector<int>(qs.rbegin(), qs.rend()), it->second);
+        m_removed += leaves.size() - 1;
+    }
+}
+
+void Optimiser::inlineCustomGates(std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    std::vector<std::unique_ptr<Gate>> flat;
+    for (auto &g : gateList)
+    {
+        CustomGate *cg = dynamic_cast<CustomGate*>(g.get());
+        if (!cg)
+        {
+            flat.push_back(std::move(g));
+            continue;
+        }
+        std::vector<std::unique_ptr<Gate>> body = cg->releaseGates();
+        inlineCustomGates(body);
+        for (auto &bg : body)
+        {
+            flat.push_back(std::move(bg));
+        }
+    }
+    gateList = std::move(flat);
+}
+
+// Checks gates[start, start+width) are uncontrolled gates called name on distinct qubits
+bool Optimiser::matchLayer(const std::vector<Gate*> &gates, size_t start, size_t width, std::string name, std::vector<int> &qubits)
+{
+    qubits.clear();
+    if (start + width > gates.size()) {return false;}
+    for (size_t i=start; i<start+width; ++i)
+    {
+        MatrixGate *mg = dynamic_cast<MatrixGate*>(gates[i]);
+        if (!mg || mg->name() != name || !mg->controlQubits().empty()) {return false;}
+        if (std::find(qubits.begin(), qubits.end(), mg->activeQubit()) != qubits.end()) {return false;}
+        qubits.push_back(mg->activeQubit());
+    }
+    std::sort(qubits.begin(), qubits.end());
+    return true;
+}
+
+// Width k of the H^k X^k C..CZ X^k H^k reflection starting at gates[i], 0 if there is none.
+// qubits receives the k qubits it acts on.
+size_t Optimiser::diffusionAt(const std::vector<Gate*> &gates, size_t i, std::vector<int> &qubits)
+{
+    size_t width = 0;
+    while (i + width < gates.size() && gates[i+width]->name() == "H") {++width;}
+    std::vector<int> xs, zs;
+    for (size_t k=width; k>=2; --k)
+    {
+        if (!matchLayer(gates, i, k, "H", qubits)) {continue;}
+        if (!matchLayer(gates, i+k, k, "X", xs) || xs != qubits) {continue;}
+        if (i + 2*k >= gates.size()) {continue;}
+        MatrixGate *z = dynamic_cast<MatrixGate*>(gates[i+2*k]);
+        if (!z || z->name() != "Z") {continue;}
+        zs = z->controlQubits();
+        zs.push_back(z->activeQubit());
+        std::sort(zs.begin(), zs.end());
+        if (zs != qubits) {continue;}
+        if (!matchLayer(gates, i+2*k+1, k, "X", xs) || xs != qubits) {continue;}
+        if (!matchLayer(gates, i+3*k+1, k, "H", xs) || xs != qubits) {continue;}
+        return k;
+    }
+    return 0;
+}
+
+bool Optimiser::containsDiffusion(const std::vector<Gate*> &gates)
+{
+    std::vector<int> qubits;
+    for (size_t i=0; i<gates.size(); ++i)
+    {
+        if (gates[i]->name() == "DIFFUSE" || diffusionAt(gates, i, qubits) > 0) {return true;}
+    }
+    return false;
+}
+
+void Optimiser::substituteDiffusion(std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    // H^k X^k C..CZ X^k H^k on the same k qubits is I - 2|s><s|
+    std::vector<Gate*> gates;
+    gates.reserve(gateList.size());
+    for (auto &g : gateList)
+    {
+        gates.push_back(g.get());
+    }
+    std::vector<std::unique_ptr<Gate>> result;
+    std::vector<int> qubits;
+    size_t i = 0;
+    while (i < gateList.size())
+    {
+        size_t k = diffusionAt(gates, i, qubits);
+        if (k > 0)
+        {
+            result.push_back(std::make_unique<DiffusionGate>(qubits, -1.0));
+            i += 4*k+1;
+        }
+        else
+        {
+            result.push_back(std::move(gateList[i]));
+            ++i;
+        }
+    }
+    gateList = std::move(result);
+}
+
+// Drops every gate outside the backward light cone of the observed qubits and relabels the
+// qubits still in use as 1..k. Returns map with map[q] the new label of q, 0 if q was dropped.
+std::vector<int> Optimiser::pruneLightCone(std::vector<std::unique_ptr<Gate>> &gateList, const std::vector<int> &observed, int numQubits)
+{
+    // Compile and substitute first, the cone is traced through the flat list and would otherwise
+    // inline every definition and cut reflections down to the gates it reaches
+    if (m_level >= 1) {compileCustomGates(gateList);}
+    inlineCustomGates(gateList);
+    if (m_level >= 1) {substituteDiffusion(gateList);}
+    std::vector<bool> live(numQubits+1, false);
+    for (int q : observed)
+    {
+        live[q] = true;
+    }
+    std::vector<std::unique_ptr<Gate>> kept;
+    for (size_t i=gateList.size(); i-- > 0;)
+    {
+        std::vector<int> qs = gateList[i]->qubits();
+        bool touches = gateList[i]->isCheckpoint();
+        for (int q : qs)
+        {
+            touches = touches || live[q];
+        }
+        if (!touches)
+        {
+            m_removed += 1;
+            continue;
+        }
+        for (int q : qs)
+        {
+            live[q] = true;
+        }
+        kept.push_back(std::move(gateList[i]));
+    }
+    std::reverse(kept.begin(), kept.end());
+    gateList = std::move(kept);
+    std::vector<int> map(numQubits+1, 0);
+    int next = 0;
+    for (int q=1; q<=numQubits; ++q)
+    {
+        if (live[q]) {map[q] = ++next;}
+    }
+    if (next < numQubits)
+    {
+        for (auto &g : gateList)
+        {
+            g->remap(map);
+        }
+    }
+    return map;
+}
+
+bool Optimiser::commute(Gate *g, Gate *h)
+{
+    std::vector<int> hqs = h->qubits();
+    for (int q : g->qubits())
+    {
+        if (std::find(hqs.begin(), hqs.end(), q) == hqs.end()) {continue;}
+        if (m_level < 2) {return false;}
+        Basis b = basisOn(g, q);
+        if (b == BASIS_OTHER || b != basisOn(h, q)) {return false;}
+    }
+    return true;
+}
+
+// Folds later into earlier when both act on the same target and controls, earlier is reset
+// when the pair cancels
+bool Optimiser::combine(std::unique_ptr<Gate> &earlier, Gate *later)
+{
+    MatrixGate *a = dynamic_cast<MatrixGate*>(earlier.get());
+    MatrixGate *b = dynamic_cast<MatrixGate*>(later);
+    if (a && b)
+    {
+        if (a->activeQubit() != b->activeQubit() || sorted(a->controlQubits()) != sorted(b->controlQubits())) {return false;}
+        std::vector<c> product = multiply(b->matrix(), a->matrix());
+        if (isIdentity(product))
+        {
+            earlier.reset();
+            m_removed += 2;
+            return true;
+        }
+        // Rotations about the same axis always merge, any other pair only at -O2
+        bool rotation = a->name() == b->name() && (a->name() == "RX" || a->name() == "RY" || a->name() == "RZ" || a->name() == "P" || a->name() == "U1");
+        if (!rotation && m_level < 2) {return false;}
+        earlier = std::make_unique<MatrixGate>(rotation ? a->name() : "U", a->activeQubit(), product, a->controlQubits());
+        m_removed += 1;
+        return true;
+    }
+    SwapGate *s = dynamic_cast<SwapGate*>(earlier.get());
+    SwapGate *t = dynamic_cast<SwapGate*>(later);
+    if (s && t)
+    {
+        if (sorted({s->activeQubit(), s->swapQubit()}) != sorted({t->activeQubit(), t->swapQubit()})) {return false;}
+        if (sorted(s->controlQubits()) != sorted(t->controlQubits())) {return false;}
+        earlier.reset();
+        m_removed += 2;
+        return true;
+    }
+    return false;
+}
+
+void Optimiser::peephole(std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    std::vector<std::unique_ptr<Gate>> out;
+    for (auto &g : gateList)
+    {
+        MatrixGate *mg = dynamic_cast<MatrixGate*>(g.get());
+        if (mg && isIdentity(mg->matrix()))
+        {
+            m_removed += 1;
+            continue;
+        }
+        bool absorbed = false;
+        int searched = 0;
+        for (size_t i=out.size(); i-- > 0 && searched < PEEPHOLE_WINDOW && !g->isCheckpoint();)
+        {
+            if (!out[i]) {continue;}
+            if (out[i]->isCheckpoint()) {break;}
+            ++searched;
+            if (combine(out[i], g.get()))
+            {
+                absorbed = true;
+                break;
+            }
+            if (!commute(g.get(), out[i].get())) {break;}
+        }
+        if (!absorbed)
+        {
+            out.push_back(std::move(g));
+        }
+    }
+    gateList.clear();
+    for (auto &g : out)
+    {
+        if (g) {gateList.push_back(std::move(g));}
+    }
+}
+
+void Optimiser::fuseDiagonals(std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    std::vector<std::unique_ptr<Gate>> fused;
+    size_t i = 0;
+    while (i < gateList.size())
+    {
+        // Maximal run of diagonal single-target gates, whatever qubits and controls they use
+        size_t end = i;
+        while (end < gateList.size() && gateList[end]->isDiagonal() && dynamic_cast<MatrixGate*>(gateList[end].get()))
+        {
+            ++end;
+        }
+        if (end - i < 2)
+        {
+            fused.push_back(std::move(gateList[i]));
+            i = std::max(end, i+1);
+            continue;
+        }
+        std::vector<DiagonalTerm> terms;
+        for (; i<end; ++i)
+        {
+            MatrixGate *mg = static_cast<MatrixGate*>(gateList[i].get());
+            DiagonalTerm t;
+            t.controlMask = 0;
+            for (int cq : mg->controlQubits())
+            {
+                t.controlMask |= size_t(1) << (cq-1);
+            }
+            t.activeBit = size_t(1) << (mg->activeQubit()-1);
+            t.d0 = mg->matrix()[0];
+            t.d1 = mg->matrix()[3];
+            terms.push_back(t);
+        }
+        fused.push_back(std::make_unique<DiagonalGate>(terms));
+    }
+    gateList = std::move(fused);
+}
@@ -0,0 +1,48 @@
+#ifndef Optimiser_H
+#define Optimiser_H
+
+#include "Gate.h"
+#include "CustomGate.h"
+#include "DefaultGate.h"
+#include "DiagonalGate.h"
+#include "DiffusionGate.h"
+#include "UnitaryGate.h"
+#include <map>
+
+// Rewrites the parsed gate list into an equivalent, cheaper one.
+// Level 0 leaves the list untouched, level 1 compiles definitions on at most five qubits into a
+// dense unitary unless they are all diagonal or contain a diffusion reflection, inlines the rest,
+// substitutes the diffusion
+// kernel for H/X/CZ/X/H reflections, cancels and merges gates only separated by gates on other
+// qubits and fuses diagonal runs. Level 2 also commutes gates past gates sharing qubits when
+// both act in the same basis on every shared qubit.
+class Optimiser
+{
+public:
+    Optimiser();
+    void setLevel(int level);
+    void optimise(std::vector<std::unique_ptr<Gate>> &gateList);
+    // The count covers the light cone pruning and every pass since the last reset
+    int removed() {return m_removed;}
+    void resetRemoved() {m_removed = 0;}
+    void report();
+    std::vector<int> pruneLightCone(std::vector<std::unique_ptr<Gate>> &gateList, const std::vector<int> &observed, int numQubits);
+private:
+    void compileCustomGates(std::vector<std::unique_ptr<Gate>> &gateList);
+    void inlineCustomGates(std::vector<std::unique_ptr<Gate>> &gateList);
+    void substituteDiffusion(std::vector<std::unique_ptr<Gate>> &gateList);
+    bool matchLayer(const std::vector<Gate*> &gates, size_t start, size_t width, std::string name, std::vector<int> &qubits);
+    size_t diffusionAt(const std::vector<Gate*> &gates, size_t i, std::vector<int> &qubits);
+    bool containsDiffusion(const std::vector<Gate*> &gates);
+    void peephole(std::vector<std::unique_ptr<Gate>> &gateList);
+    bool commute(Gate *g, Gate *h);
+    bool combine(std::unique_ptr<Gate> &earlier, Gate *later);
+    void fuseDiagonals(std::vector<std::unique_ptr<Gate>> &gateList);
+
+    int m_level;
+    int m_removed;
+    // Unitaries of compiled definitions, keyed by the body relabelled onto qubits 1..k
+    std::map<std::string, std::vector<c>> m_compiled;
+};
+
+#endif
@@ -0,0 +1,147 @@
+#include "Parallel.h"
+
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+
+static unsigned s_workers = 0;
+static thread_local bool s_inParallel = false;
+static thread_local ParallelPartition *s_partition = nullptr;
+
+unsigned parallelWorkers()
+{
+    if (s_partition) {return s_partition->workers();}
+    if (s_workers == 0)
+    {
+        s_workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return s_workers;
+}
+
+void setParallelWorkers(unsigned workers)
+{
+    s_workers = workers;
+}
+
+// Worker threads kept alive between parallelFor calls, the caller runs chunk 0 itself.
+// Calls from different threads take turns, so each one gets every worker.
+class WorkerPool
+{
+public:
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto &t : m_threads)
+        {
+            t.join();
+        }
+    }
+
+    void run(std::size_t n, std::size_t chunks, const std::function<void(std::size_t, std::size_t, unsigned)> &fn)
+    {
+        std::lock_guard<std::mutex> call(m_callMutex);
+        std::vector<std::exception_ptr> errors(chunks);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while (m_threads.size() < chunks-1)
+            {
+                unsigned w = m_threads.size() + 1;
+                m_threads.emplace_back([this, w]{work(w);});
+            }
+            m_fn = &fn;
+            m_n = n;
+            m_chunks = chunks;
+            m_errors = &errors;
+            m_pending = chunks-1;
+            ++m_generation;
+        }
+        m_wake.notify_all();
+        runChunk(0);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [this]{return m_pending == 0;});
+        lock.unlock();
+        for (auto &e : errors)
+        {
+            if (e) {std::rethrow_exception(e);}
+        }
+    }
+
+private:
+    void runChunk(unsigned w)
+    {
+        s_inParallel = true;
+        try
+        {
+            (*m_fn)(m_n * w / m_chunks, m_n * (w + 1) / m_chunks, w);
+        } catch (...) {
+            (*m_errors)[w] = std::current_exception();
+        }
+        s_inParallel = false;
+    }
+
+    void work(unsigned w)
+    {
+        unsigned long seen = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_wake.wait(lock, [&]{return m_stop || m_generation != seen;});
+            if (m_stop) {return;}
+            seen = m_generation;
+            if (w >= m_chunks) {continue;}
+            lock.unlock();
+            runChunk(w);
+            lock.lock();
+            if (--m_pending == 0) {m_finished.notify_one();}
+        }
+    }
+
+    std::mutex m_callMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_finished;
+    std::vector<std::thread> m_threads;
+    const std::function<void(std::size_t, std::size_t, unsigned)> *m_fn = nullptr;
+    std::size_t m_n = 0;
+    std::size_t m_chunks = 0;
+    std::vector<std::exception_ptr> *m_errors = nullptr;
+    std::size_t m_pending = 0;
+    unsigned long m_generation = 0;
+    bool m_stop = false;
+};
+
+static WorkerPool s_pool;
+
+ParallelPartition::ParallelPartition(unsigned workers) : m_workers(std::max(1u, workers)), m_pool(std::make_unique<WorkerPool>())
+{
+    ;
+}
+
+ParallelPartition::~ParallelPartition()
+{
+    ;
+}
+
+void usePartition(ParallelPartition *partition)
+{
+    s_partition = partition;
+}
+
+void parallelFor(std::size_t n, const std::function<void(std::size_t, std::size_t, unsigned)> &fn, std::size_t minChunk)
+{
+    if (n == 0) {return;}
+    std::size_t chunks = std::min<std::size_t>(parallelWorkers(), (n + minChunk - 1) / std::max<std::size_t>(minChunk, 1));
+    if (chunks <= 1 || s_inParallel)
+    {
+        fn(0, n, 0);
+        return;
+    }
+    (s_partition ? s_partition->pool() : s_pool).run(n, chunks, fn);
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef Parallel_H
+#define Parallel_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+// Number of worker threads used by the parallel kernels (hardware concurrency unless overridden),
+// or the size of the partition installed on the calling thread
+unsigned parallelWorkers();
+void setParallelWorkers(unsigned workers);
+
+class WorkerPool;
+
+// A share of the machine with worker threads of its own. While a partition is installed on a
+// thread, its parallelFor calls run on that partition, so threads holding different partitions
+// compute side by side instead of taking turns on the shared pool.
+class ParallelPartition
+{
+public:
+    explicit ParallelPartition(unsigned workers);
+    ~ParallelPartition();
+    unsigned workers() const {return m_workers;}
+    WorkerPool &pool() {return *m_pool;}
+private:
+    unsigned m_workers;
+    std::unique_ptr<WorkerPool> m_pool;
+};
+
+// Installs partition on the calling thread, nullptr goes back to the shared pool
+void usePartition(ParallelPartition *partition);
+
+// Splits [0, n) into contiguous chunks of at least minChunk items, one per worker, and runs
+// fn(begin, end, worker) on every chunk concurrently on a persistent pool of worker threads.
+// Calls made from inside a chunk run serially, calls from other threads on the same pool wait
+// for their turn.
+void parallelFor(std::size_t n, const std::function<void(std::size_t, std::size_t, unsigned)> &fn, std::size_t minChunk = 1);
+
+#endif
@@ -1,7 +1,10 @@
 #include "Parser.h"
+#include "Parallel.h"
 
 const double pi = acos(-1.0);
 const std::string pi_str = "3.14159265358979";
+// Runs of plain gate lines at least this long are parsed in parallel
+const int PARALLEL_REGION_LINES = 16384;
 
 
 
@@ -12,6 +15,10 @@ Parser::Parser()
     m_symbol_map["endef"]   = END_DEFINITION;
     m_symbol_map["for"]     = FOR_LOOP;
     m_symbol_map["endfor"]  = END_FOR_LOOP;
+    m_symbol_map["checkpoint"] = CHECKPOINT;
+    m_symbol_map["observe"] = OBSERVE;
+    m_symbol_map["marginal"] = MARGINAL;
+    m_symbol_map["rdm"]     = DENSITY_MATRIX;
     m_symbol_map["H"]       = HADAMARD;
     m_symbol_map["CH"]      = CONTROLLED_HADAMARD;
     m_symbol_map["X"]       = X;
@@ -28,81 +35,196 @@ Parser::Parser()
     m_symbol_map["CRY"]     = CONTROLLED_ROTATION_Y;
     m_symbol_map["RZ"]      = ROTATION_Z;
     m_symbol_map["CRZ"]     = CONTROLLED_ROTATION_Z;
+    m_symbol_map["U1"]      = U1_GATE;
+    m_symbol_map["CU1"]     = CONTROLLED_U1_GATE;
+    m_symbol_map["U2"]      = U2_GATE;
+    m_symbol_map["CU2"]     = CONTROLLED_U2_GATE;
+    m_symbol_map["U3"]      = U3_GATE;
+    m_symbol_map["CU3"]     = CONTROLLED_U3_GATE;
     m_symbol_map["SWAP"]    = SWAP;
     m_symbol_map["CSWAP"]   = CONTROLLED_SWAP;
+    m_symbol_map["unitary"] = UNITARY;
+    m_symbol_map["QFT"]     = QFT;
+    m_symbol_map["IQFT"]    = INVERSE_QFT;
+    m_symbol_map["DIFFUSE"] = DIFFUSION;
+    m_symbol_map["DEPOL"]   = DEPOLARIZING;
+    m_symbol_map["DAMP"]    = AMPLITUDE_DAMPING;
+    m_symbol_map["READOUT"] = READOUT_ERROR;
 
     m_isInitialised = false;
     m_inDef = false;
     m_inLoop = false;
+    m_hasReadout = false;
 }
 
-void Parser::parse(std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR)
+void Parser::parse(std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
     int line_number = 0; 
+    int scanned = 0;
     while (line_number<m_lines.size())  
     {
         ++line_number;
-        parseLine(line_number, m_lines[line_number-1], gateList, nQ, qR); 
+        // Top level gate lines do not depend on each other, long runs of them are split between the workers
+        if (line_number > scanned && m_isInitialised && !m_inDef && !m_inLoop && m_lines.size()-line_number+1 >= PARALLEL_REGION_LINES)
+        {
+            scanned = plainRegionEnd(line_number);
+            if (scanned-line_number+1 >= PARALLEL_REGION_LINES)
+            {
+                parseRegion(line_number, scanned, gateList, nQ);
+                line_number = scanned;
+                continue;
+            }
+        }
+        parseLine(line_number, m_lines[line_number-1], gateList, nQ); 
     } 
     pAssert(!m_inDef, "EOF - definition not closed", line_number);
     pAssert(!m_inLoop, "EOF - loop not closed", line_number);
+    pAssert(m_isInitialised, "Circuit must be initialised", line_number);
+    if (m_hasReadout)
+    {
+        std::vector<bool> readout(nQ+1, false);
+        checkReadout(gateList, readout);
+    }
 }
 
-void Parser::scanLines(std::string &filename)
+// READOUT flips the qubit in the state, which only models a faulty measurement when no
+// later gate acts on that qubit
+void Parser::checkReadout(std::vector<std::unique_ptr<Gate>> &gateList, std::vector<bool> &readout)
 {
-    std::ifstream infile(filename);
-    std::string line;
-    while (std::getline(infile, line))
+    for (auto &gate : gateList)
     {
-        m_lines.push_back(line);        
+        if (CustomGate *custom = dynamic_cast<CustomGate*>(gate.get()))
+        {
+            checkReadout(custom->gates(), readout);
+        } else if (gate->name() == "READOUT") {
+            readout[gate->qubits()[0]] = true;
+        } else {
+            for (int q : gate->qubits())
+            {
+                if (readout[q]) {throw ParseError("'"+gate->name()+"' acts on qubit "+std::to_string(q)+" after READOUT, readout errors must follow the last gate on a qubit");}
+            }
+        }
     }
 }
 
+int Parser::plainRegionEnd(int first)
+{
+    int last = first-1;
+    while (last<m_lines.size() && isPlainLine(m_lines[last])) {++last;}
+    return last;
+}
+
+bool Parser::isPlainLine(std::string_view line)
+{
+    if (line.find('$') != std::string_view::npos) {return false;}
+    Tokenizer tokens(line);
+    std::string_view symbolstr;
+    if (!tokens.word(symbolstr) || symbolstr.rfind("//", 0) == 0) {return true;}
+    auto it = m_symbol_map.find(symbolstr);
+    return it != m_symbol_map.end() && it->second >= IDENTITY && it->second <= READOUT_ERROR;
+}
+
+void Parser::parseRegion(int first, int last, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+{
+    // Each worker parses a contiguous block into its own list, the lists are joined in order.
+    // The parser state is only read here, apart from the atomic m_hasReadout, and the first error
+    // by line number is rethrown
+    std::vector<std::vector<std::unique_ptr<Gate>>> parts(parallelWorkers());
+    parallelFor(last-first+1, [&](size_t begin, size_t end, unsigned worker)
+    {
+        // At most one gate per line, so neither list grows by doubling
+        parts[worker].reserve(parts[worker].size() + end-begin);
+        for (size_t i=begin; i<end; ++i)
+        {
+            int line_number = first+i;
+            parseLine(line_number, m_lines[line_number-1], parts[worker], nQ);
+        }
+    }, 4096);
+    size_t total = gateList.size();
+    for (auto &part : parts)
+    {
+        total += part.size();
+    }
+    // The first part is taken over when nothing precedes it, and every part is freed once joined
+    if (gateList.empty()) {gateList.swap(parts[0]);}
+    gateList.reserve(total);
+    for (auto &part : parts)
+    {
+        std::move(part.begin(), part.end(), std::back_inserter(gateList));
+        std::vector<std::unique_ptr<Gate>>().swap(part);
+    }
+}
+
+void Parser::scanText(const std::string &text)
+{
+    m_source.assign(text);
+    m_source.lines(m_lines);
+}
+
+void Parser::scanLines(std::string &filename)
+{
+    if (!m_source.open(filename)) {throw ParseError("Cannot open file '"+filename+"'");}
+    m_source.lines(m_lines);
+}
+
 void Parser::reset()
 {
     m_isInitialised = false;
-    m_symbol_map;
     for (auto it = m_defs.begin(); it != m_defs.end(); ++it)
     {
-        m_symbol_map.erase(m_symbol_map.find(it->first));
+        m_symbol_map.erase(it->first);
     }
     m_defs.clear();
+    m_observed.clear();
+    m_reports.clear();
+    m_lines.clear();
+    m_source.close();
+    m_loops.clear();
+    m_vars.clear();
+    m_inDef = false;
+    m_inLoop = false;
+    m_hasReadout = false;
 }
 
-void Parser::parseLine(int &line_number, std::string &line, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR)
+void Parser::parseLine(int &line_number, std::string_view line, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
-    formatLine(line_number, line);
-    std::istringstream iss(line);
+    std::string buffer;
+    Tokenizer tokens(formatLine(line_number, line, buffer));
     Symbol symbol;
-    std::string symbolstr;
-    symHandler(line_number, iss, symbol, symbolstr);
+    std::string_view symbolstr;
+    symHandler(line_number, tokens, symbol, symbolstr);
     initialChecksHandler(line_number, symbol);
-    commandHandler(line_number, iss, symbol, symbolstr, gateList, nQ, qR);
+    commandHandler(line_number, tokens, symbol, symbolstr, gateList, nQ);
 }
 
-void Parser::formatLine(int &line_number,std::string &line)
+std::string_view Parser::formatLine(int &line_number, std::string_view line, std::string &buffer)
 {
     size_t start = line.find_first_not_of(" \n\r\t\f\v");
-    line = (start == std::string::npos) ? "" : line.substr(start);
+    if (start == std::string_view::npos) {return std::string_view();}
     size_t end = line.find_last_not_of(" \n\r\t\f\v");
-    line = (end == std::string::npos) ? "" : line.substr(0, end + 1);
-    std::reverse(m_vars.begin(), m_vars.end());
-    for (const std::pair<std::string, std::string>& var : m_vars) 
+    line = line.substr(start, end + 1 - start);
+    // Innermost variables first, the line is only copied once one of them occurs in it
+    bool copied = false;
+    for (auto var = m_vars.rbegin(); var != m_vars.rend(); ++var)
     {
-        if (!var.first.compare(NESTED_FUNC_SPLIT)) {break;}
-        line = replaceVar(line, var.first, var.second);
+        if (!var->first.compare(NESTED_FUNC_SPLIT)) {break;}
+        if (line.find(var->first) == std::string_view::npos) {continue;}
+        if (!copied) {buffer.assign(line); copied = true;}
+        buffer = replaceVar(buffer, var->first, var->second);
+        line = buffer;
     }
-    std::reverse(m_vars.begin(), m_vars.end());
+    return line;
 }
 
-void Parser::symHandler(int &line_number, std::istringstream &iss, Symbol &symbol, std::string &symbolstr)
+void Parser::symHandler(int &line_number, Tokenizer &tokens, Symbol &symbol, std::string_view &symbolstr)
 {
-    iss >> symbolstr;
+    tokens.word(symbolstr);
     if (symbolstr.rfind("//", 0) == 0 || symbolstr.empty()) {symbol = SKIP;}
     else 
     {
-        pAssert(m_symbol_map.count(symbolstr) > 0, "Symbol not found - '"+symbolstr+"'", line_number);
-        symbol = m_symbol_map[symbolstr];
+        auto it = m_symbol_map.find(symbolstr);
+        if (it == m_symbol_map.end()) {pError("Symbol not found - '"+std::string(symbolstr)+"'", line_number);}
+        symbol = it->second;
     }
 }
 
@@ -131,6 +253,14 @@ void Parser::initialChecksHandler(int &line_number, Symbol &symbol)
         if (m_inDef) {symbol = SKIP;} else {pAssert(m_isInitialised, "Circuit must be initialised", line_number); 
                                             pAssert(m_inLoop, "No loop defined", line_number);}  
 
+    } else if (symbol == CHECKPOINT) {
+        pAssert(!m_inDef, "checkpoint cannot be declared in definition", line_number);
+        pAssert(m_isInitialised, "Circuit must be initialised", line_number);
+
+    } else if (symbol == OBSERVE || symbol == MARGINAL || symbol == DENSITY_MATRIX) {
+        pAssert(!m_inDef, "Outputs cannot be declared in definition", line_number);
+        pAssert(m_isInitialised, "Circuit must be initialised", line_number);
+
     } else if (symbol == SKIP) {
         ;
     } else {
@@ -138,7 +268,7 @@ void Parser::initialChecksHandler(int &line_number, Symbol &symbol)
     }
 }
 
-void Parser::commandHandler(int &line_number, std::istringstream &iss, Symbol &symbol, std::string &symbolstr, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR)
+void Parser::commandHandler(int &line_number, Tokenizer &tokens, Symbol &symbol, std::string_view &symbolstr, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
 
     if (
@@ -152,7 +282,7 @@ void Parser::commandHandler(int &line_number, std::istringstream &iss, Symbol &s
         symbol == CONTROLLED_Z
         ) 
     {
-        defaultGate(line_number, iss, symbol, gateList, nQ);
+        defaultGate(line_number, tokens, symbol, gateList, nQ);
 
     } else if (
         symbol == PHASE_SHIFT ||
@@ -165,32 +295,69 @@ void Parser::commandHandler(int &line_number, std::istringstream &iss, Symbol &s
         symbol == CONTROLLED_ROTATION_Z
         ) 
     {
-        defaultAngleGate(line_number, iss, symbol, gateList, nQ);
+        defaultAngleGate(line_number, tokens, symbol, gateList, nQ);
+
+    } else if (
+        symbol == U1_GATE ||
+        symbol == U2_GATE ||
+        symbol == U3_GATE ||
+        symbol == CONTROLLED_U1_GATE ||
+        symbol == CONTROLLED_U2_GATE ||
+        symbol == CONTROLLED_U3_GATE
+        )
+    {
+        defaultMultiAngleGate(line_number, tokens, symbol, gateList, nQ);
+
+    } else if (symbol == UNITARY) {
+        unitaryGate(line_number, tokens, gateList, nQ);
+
+    } else if (symbol == QFT || symbol == INVERSE_QFT) {
+        qftGate(line_number, tokens, symbol, gateList, nQ);
+
+    } else if (symbol == DIFFUSION) {
+        diffusionGate(line_number, tokens, gateList, nQ);
 
     } else if (
         symbol == SWAP ||
         symbol == CONTROLLED_SWAP
         )
     {
-        defaultMultiQubitGate(line_number, iss, symbol, gateList, nQ);
+        defaultMultiQubitGate(line_number, tokens, symbol, gateList, nQ);
+
+    } else if (
+        symbol == DEPOLARIZING ||
+        symbol == AMPLITUDE_DAMPING ||
+        symbol == READOUT_ERROR
+        )
+    {
+        noiseChannel(line_number, tokens, symbol, gateList, nQ);
 
     } else if (symbol==CUSTOM) {
-        customGate(line_number, iss, symbolstr, gateList, nQ, qR);
+        customGate(line_number, tokens, symbolstr, gateList, nQ);
     
     } else if (symbol==INITIALISE) {
-        initialise(line_number, iss, nQ, qR);
+        initialise(line_number, tokens, nQ);
 
     } else if (symbol == DEFINITION) {
-        definition(line_number, iss);
+        definition(line_number, tokens);
 
     } else if (symbol == END_DEFINITION) {
-        endDefinition(line_number, iss);
+        endDefinition(line_number, tokens);
 
     } else if (symbol == FOR_LOOP) {
-        forLoop(line_number, iss, gateList, nQ, qR);
+        forLoop(line_number, tokens, gateList, nQ);
 
     } else if (symbol == END_FOR_LOOP) {
-        endForLoop(line_number, iss);
+        endForLoop(line_number, tokens);
+
+    } else if (symbol == CHECKPOINT) {
+        checkpoint(line_number, tokens, gateList);
+
+    } else if (symbol == OBSERVE) {
+        observe(line_number, tokens, nQ);
+
+    } else if (symbol == MARGINAL || symbol == DENSITY_MATRIX) {
+        report(line_number, tokens, symbol, nQ);
 
     } else if (symbol == SKIP) {
         ;
@@ -199,11 +366,11 @@ void Parser::commandHandler(int &line_number, std::istringstream &iss, Symbol &s
     }
 }
 
-void Parser::defaultGate(int &line_number, std::istringstream &iss, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+void Parser::defaultGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
     // Initalise command variables
     int aq;
-    parseQubit(line_number, aq, iss, nQ);
+    parseQubit(line_number, aq, tokens, nQ);
     switch (symbol)
     {
         case IDENTITY : gateList.push_back(std::make_unique<IdentityGate>(aq)); return;
@@ -214,23 +381,23 @@ void Parser::defaultGate(int &line_number, std::istringstream &iss, Symbol symbo
         return;
     }
     std::vector<int> cqs;
-    parseControlQubits(line_number,cqs, iss, nQ);
+    parseControlQubits(line_number, cqs, {aq}, tokens, nQ);
     switch (symbol)
     {
-        case CONTROLLED_HADAMARD :  gateList.push_back(std::make_unique<HadamardGate>(aq, cqs)); return;
-        case CONTROLLED_X :         gateList.push_back(std::make_unique<XGate>(aq, cqs)); return;
-        case CONTROLLED_Y :         gateList.push_back(std::make_unique<YGate>(aq, cqs)); return;
-        case CONTROLLED_Z :         gateList.push_back(std::make_unique<ZGate>(aq, cqs)); return;
+        case CONTROLLED_HADAMARD :  gateList.push_back(std::make_unique<HadamardGate>(aq, std::move(cqs))); return;
+        case CONTROLLED_X :         gateList.push_back(std::make_unique<XGate>(aq, std::move(cqs))); return;
+        case CONTROLLED_Y :         gateList.push_back(std::make_unique<YGate>(aq, std::move(cqs))); return;
+        case CONTROLLED_Z :         gateList.push_back(std::make_unique<ZGate>(aq, std::move(cqs))); return;
         return;
     }
 }
 
-void Parser::defaultAngleGate(int &line_number, std::istringstream &iss, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+void Parser::defaultAngleGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
     int aq;
     double ph;
-    parseQubit(line_number, aq, iss, nQ);
-    parseAngle(line_number, ph, iss);
+    parseQubit(line_number, aq, tokens, nQ);
+    parseAngle(line_number, ph, tokens);
     switch (symbol)
     {
         case PHASE_SHIFT :  gateList.push_back(std::make_unique<PhaseShiftGate>(aq, ph)); return;
@@ -239,54 +406,165 @@ void Parser::defaultAngleGate(int &line_number, std::istringstream &iss, Symbol
         case ROTATION_Z :   gateList.push_back(std::make_unique<RotationZGate>(aq, ph)); return;
     }
     std::vector<int> cqs;
-    parseControlQubits(line_number, cqs, iss, nQ);
+    parseControlQubits(line_number, cqs, {aq}, tokens, nQ);
+    switch (symbol)
+    {
+        case CONTROLLED_PHASE_SHIFT :   gateList.push_back(std::make_unique<PhaseShiftGate>(aq, ph, std::move(cqs))); return;
+        case CONTROLLED_ROTATION_X :    gateList.push_back(std::make_unique<RotationXGate>(aq, ph, std::move(cqs))); return;
+        case CONTROLLED_ROTATION_Y :    gateList.push_back(std::make_unique<RotationYGate>(aq, ph, std::move(cqs))); return;
+        case CONTROLLED_ROTATION_Z :    gateList.push_back(std::make_unique<RotationZGate>(aq, ph, std::move(cqs))); return;
+    }
+}
+
+void Parser::defaultMultiAngleGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+{
+    int aq;
+    int nAngles = (symbol == U1_GATE || symbol == CONTROLLED_U1_GATE) ? 1 : (symbol == U2_GATE || symbol == CONTROLLED_U2_GATE) ? 2 : 3;
+    std::vector<double> ph(nAngles);
+    parseQubit(line_number, aq, tokens, nQ);
+    for (auto &phi : ph)
+    {
+        parseAngle(line_number, phi, tokens);
+    }
+    switch (symbol)
+    {
+        case U1_GATE :  gateList.push_back(std::make_unique<U1Gate>(aq, ph[0])); return;
+        case U2_GATE :  gateList.push_back(std::make_unique<U2Gate>(aq, ph[0], ph[1])); return;
+        case U3_GATE :  gateList.push_back(std::make_unique<U3Gate>(aq, ph[0], ph[1], ph[2])); return;
+    }
+    std::vector<int> cqs;
+    parseControlQubits(line_number, cqs, {aq}, tokens, nQ);
     switch (symbol)
     {
-        case CONTROLLED_PHASE_SHIFT :   gateList.push_back(std::make_unique<PhaseShiftGate>(aq, ph, cqs)); return;
-        case CONTROLLED_ROTATION_X :    gateList.push_back(std::make_unique<RotationXGate>(aq, ph, cqs)); return;
-        case CONTROLLED_ROTATION_Y :    gateList.push_back(std::make_unique<RotationYGate>(aq, ph, cqs)); return;
-        case CONTROLLED_ROTATION_Z :    gateList.push_back(std::make_unique<RotationZGate>(aq, ph, cqs)); return;
+        case CONTROLLED_U1_GATE :   gateList.push_back(std::make_unique<U1Gate>(aq, ph[0], std::move(cqs))); return;
+        case CONTROLLED_U2_GATE :   gateList.push_back(std::make_unique<U2Gate>(aq, ph[0], ph[1], std::move(cqs))); return;
+        case CONTROLLED_U3_GATE :   gateList.push_back(std::make_unique<U3Gate>(aq, ph[0], ph[1], ph[2], std::move(cqs))); return;
     }
 }
 
-void Parser::defaultMultiQubitGate(int &line_number, std::istringstream &iss, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+void Parser::unitaryGate(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+{
+    std::vector<int> qs;
+    std::vector<c> matrix;
+    std::string_view entry;
+    while (tokens.word(entry) && entry != ":")
+    {
+        Tokenizer qss(entry);
+        int q;
+        parseQubit(line_number, q, qss, nQ);
+        if (std::find(qs.begin(), qs.end(), q) != qs.end()) {pError("Repeated qubit - "+std::to_string(q), line_number);}
+        qs.push_back(q);
+    }
+    pAssert(entry == ":", "Qubits and matrix must be separated by ':'", line_number);
+    pAssert(qs.size()>=1 && qs.size()<=3, "unitary acts on 1 to 3 qubits", line_number);
+    // Entries are 're' or 're,im'
+    while (tokens.word(entry))
+    {
+        size_t comma = entry.find(',');
+        double re = eval(entry.substr(0, comma), line_number);
+        double im = (comma == std::string_view::npos) ? 0.0 : eval(entry.substr(comma+1), line_number);
+        matrix.push_back(c(re, im));
+    }
+    size_t dim = size_t(1) << qs.size();
+    if (matrix.size() != dim*dim) {pError("unitary on "+std::to_string(qs.size())+" qubits needs "+std::to_string(dim*dim)+" entries", line_number);}
+    for (size_t r=0; r<dim; ++r)
+    {
+        for (size_t col=0; col<dim; ++col)
+        {
+            c dot(0.0, 0.0);
+            for (size_t k=0; k<dim; ++k)
+            {
+                dot += std::conj(matrix[k*dim + r])*matrix[k*dim + col];
+            }
+            pAssert(std::abs(dot - c(r==col ? 1.0 : 0.0, 0.0)) < 1e-6, "Matrix is not unitary", line_number);
+        }
+    }
+    gateList.push_back(std::make_unique<UnitaryGate>(qs, matrix));
+}
+
+void Parser::qftGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+{
+    std::string_view range;
+    std::string_view check_extra;
+    pAssert(tokens.word(range), "Requires qubit range low:high", line_number);
+    size_t delimeter = range.find(':');
+    pAssert(delimeter != std::string_view::npos, "Low and high qubits must be separated by ':'", line_number);
+    Tokenizer lss(range.substr(0, delimeter));
+    Tokenizer hss(range.substr(delimeter+1));
+    int low;
+    int high;
+    parseQubit(line_number, low, lss, nQ);
+    parseQubit(line_number, high, hss, nQ);
+    pAssert(low<=high, "Low qubit must not exceed high qubit", line_number);
+    pAssert(!tokens.word(check_extra), "invalid syntax", line_number);
+    gateList.push_back(std::make_unique<QftGate>(low, high, symbol == INVERSE_QFT));
+}
+
+void Parser::diffusionGate(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+{
+    std::vector<int> qs;
+    parseQubitList(line_number, qs, tokens, nQ);
+    if (qs.empty())
+    {
+        qs.resize(nQ);
+        std::iota(qs.begin(), qs.end(), 1);
+    }
+    gateList.push_back(std::make_unique<DiffusionGate>(qs));
+}
+
+void Parser::defaultMultiQubitGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
     int aq;
     int q2;
-    parseQubit(line_number, aq, iss, nQ);
-    parseQubit(line_number, q2, iss, nQ);
+    parseQubit(line_number, aq, tokens, nQ);
+    parseQubit(line_number, q2, tokens, nQ);
     switch (symbol)
     {
         case SWAP : gateList.push_back(std::make_unique<SwapGate>(aq, q2)); return;
     }
     std::vector<int> cqs;
-    parseControlQubits(nQ, cqs, iss, nQ);
+    parseControlQubits(line_number, cqs, {aq, q2}, tokens, nQ);
     switch (symbol)
     {
         case CONTROLLED_SWAP : gateList.push_back(std::make_unique<SwapGate>(aq, q2)); return;        
     }
 }
 
-void Parser::customGate(int &line_number, std::istringstream &iss, std::string &sym, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR)
+void Parser::noiseChannel(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
+{
+    int aq;
+    double p;
+    parseQubit(line_number, aq, tokens, nQ);
+    parseProbability(line_number, p, tokens);
+    switch (symbol)
+    {
+        case DEPOLARIZING :         gateList.push_back(std::make_unique<DepolarizingChannel>(aq, p)); return;
+        case AMPLITUDE_DAMPING :    gateList.push_back(std::make_unique<AmplitudeDampingChannel>(aq, p)); return;
+        case READOUT_ERROR :        m_hasReadout = true; gateList.push_back(std::make_unique<ReadoutErrorChannel>(aq, p)); return;
+    }
+}
+
+void Parser::customGate(int &line_number, Tokenizer &tokens, std::string_view sym, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ)
 {
     std::vector<std::unique_ptr<Gate>> gates;
-    std::string var;
+    std::string_view var;
     std::vector<std::string> func_vars;
-    while (iss>>var) 
+    while (tokens.word(var)) 
     {
-        func_vars.push_back(var);
+        func_vars.emplace_back(var);
     }
-    pAssert(func_vars.size() == m_defs[sym].variables.size(), "invalid number of vars", line_number);
+    const DefinitionData &def = m_defs.find(sym)->second;
+    pAssert(func_vars.size() == def.variables.size(), "invalid number of vars", line_number);
     m_vars.push_back({NESTED_FUNC_SPLIT, NESTED_FUNC_SPLIT});
     for (int i=0; i<func_vars.size(); ++i)
     {
-        m_vars.push_back({m_defs[sym].variables[i], func_vars[i]});
+        m_vars.push_back({def.variables[i], func_vars[i]});
     }
-    for (int cg_line_number=m_defs[sym].def_line+1; cg_line_number<m_defs[sym].endef_line; ++cg_line_number)
+    for (int cg_line_number=def.def_line+1; cg_line_number<def.endef_line; ++cg_line_number)
     {
-        parseLine(cg_line_number, m_lines[cg_line_number-1], gates, nQ, qR);
+        parseLine(cg_line_number, m_lines[cg_line_number-1], gates, nQ);
     }
-    gateList.push_back(std::make_unique<CustomGate>(sym, std::move(gates)));
+    gateList.push_back(std::make_unique<CustomGate>(std::string(sym), std::move(gates)));
     for (int i=0; i<func_vars.size(); ++i)
     {
         m_vars.pop_back();
@@ -294,69 +572,68 @@ void Parser::customGate(int &line_number, std::istringstream &iss, std::string &
     m_vars.pop_back();
 }
 
-void Parser::initialise(int &line_number, std::istringstream &iss, int &nQ, std::vector<c> &qR)
+void Parser::initialise(int &line_number, Tokenizer &tokens, int &nQ)
 {
     int n;
-    std::string check_extra;
+    std::string_view check_extra;
     // Special Checks
-    pAssert(!(!(iss>>n)), "no number of qubits given", line_number);
+    pAssert(tokens.integer(n), "no number of qubits given", line_number);
     pAssert(n>0, "number of qubits must be greater than zero", line_number);
-    pAssert(!(iss>>check_extra), "invalid syntax", line_number);
+    pAssert(n<64, "number of qubits must be less than 64", line_number);
+    pAssert(!tokens.word(check_extra), "invalid syntax", line_number);
     // Command action
+    // The register itself is only set up when the circuit runs, possibly as a sparse one
     nQ = n;
-    qR.resize(pow(2,n));
-    qR[0]=c(1.0, 0.0);
     // Set environment variables
     m_isInitialised = true;
 }
 
-void Parser::definition(int &line_number, std::istringstream &iss)
+void Parser::definition(int &line_number, Tokenizer &tokens)
 {
     std::vector<std::string> def_vars;
-    std::string def_name;
+    std::string_view def_name;
     DefinitionData data;
-    std::string var;
-    pAssert(!(!(iss>>def_name)), "empty def name", line_number);
-    pAssert(m_symbol_map.find(def_name) == m_symbol_map.end(), "Name already defined - '"+def_name+"'", line_number);
-    pAssert(!def_name.empty() && def_name.find_first_not_of("0123456789") != std::string::npos, "Invalid name, name can't be a number - '"+def_name+"'", line_number);
-    while (iss>>var)
+    std::string_view var;
+    pAssert(tokens.word(def_name), "empty def name", line_number);
+    if (m_symbol_map.find(def_name) != m_symbol_map.end()) {pError("Name already defined - '"+std::string(def_name)+"'", line_number);}
+    if (def_name.empty() || def_name.find_first_not_of("0123456789") == std::string_view::npos) {pError("Invalid name, name can't be a number - '"+std::string(def_name)+"'", line_number);}
+    while (tokens.word(var))
         {
             pAssert(var.rfind("$", 0) == 0, "var doesnt start with $", line_number);
-            def_vars.push_back(var);
+            def_vars.emplace_back(var);
         }
     data.def_line = line_number;
     data.variables = def_vars;
-    m_defs.emplace(def_name, data);
     m_currentDefName = def_name; 
-    m_symbol_map[def_name] = CUSTOM;
+    auto def = m_defs.emplace(m_currentDefName, data).first;
+    m_symbol_map[def->first] = CUSTOM;
     m_inDef = true;
 }
 
-void Parser::endDefinition(int &line_number, std::istringstream &iss)
+void Parser::endDefinition(int &line_number, Tokenizer &tokens)
 {
-    std::string check_extra;
-    iss>>check_extra;
-    pAssert(!(iss>>check_extra), "invalid syntax", line_number);
+    std::string_view check_extra;
+    tokens.word(check_extra);
+    pAssert(!tokens.word(check_extra), "invalid syntax", line_number);
     m_defs[m_currentDefName].endef_line = line_number;
     m_inDef = false;
 }
 
-void Parser::forLoop(int &line_number, std::istringstream &iss, std::vector<std::unique_ptr<Gate>> &gateList, int nQ, std::vector<c> &qR)
+void Parser::forLoop(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList, int nQ)
 {
     m_inLoop = true;
     int loop_num = m_loops.size();
-    std::string line;
     int lp_line_number;
-    std::string var;
+    std::string_view var;
     int start_idx;
     int end_idx;
     char delimeter;
-    pAssert(!(!(iss>>var)), "No loop variable given", line_number);
+    pAssert(tokens.word(var), "No loop variable given", line_number);
     pAssert(var.rfind("$", 0) == 0, "var doesnt start with $", line_number);
-    pAssert(!(!(iss>>start_idx)), "Integer loop start must be given", line_number);
-    pAssert(!(!(iss>>delimeter)), "Start and End must be separated by ':'", line_number);
+    pAssert(tokens.integer(start_idx), "Integer loop start must be given", line_number);
+    pAssert(tokens.character(delimeter), "Start and End must be separated by ':'", line_number);
     pAssert(delimeter == ':', "Start and End must be separated by ':'", line_number);
-    pAssert(!(!(iss>>end_idx)), "Integer loop start must be given", line_number);
+    pAssert(tokens.integer(end_idx), "Integer loop start must be given", line_number);
     LoopData data;
     data.loop_line = line_number;
     data.endloop_line = m_lines.size();
@@ -365,31 +642,60 @@ void Parser::forLoop(int &line_number, std::istringstream &iss, std::vector<std:
     data.loop_counter = loopCounter;
     m_loops.push_back(data);
     int loop_idx = m_vars.size();
-    m_vars.push_back({var, std::to_string(m_loops[loop_num].loop_counter[0])});
+    m_vars.push_back({std::string(var), std::to_string(m_loops[loop_num].loop_counter[0])});
     for (int i=0; i<loopCounter.size(); ++i)
     {
         m_vars[loop_idx].second = std::to_string(m_loops[loop_num].loop_counter[i]);
+        // A nested loop moves lp_line_number on to its own endfor
         for (lp_line_number=m_loops[loop_num].loop_line+1; lp_line_number<=m_loops[loop_num].endloop_line; ++lp_line_number)
         {
-            line_number = lp_line_number;
-            line = m_lines[line_number-1];        
-            parseLine(line_number, line, gateList, nQ, qR);
+            parseLine(lp_line_number, m_lines[lp_line_number-1], gateList, nQ);
         }
     }
+    // The caller carries on after the endfor line
+    line_number = m_loops[loop_num].endloop_line;
     m_loops.pop_back();
     m_inLoop = (m_loops.size()!=0); 
-    line_number = lp_line_number;
     m_vars.pop_back();   
 }
 
-void Parser::endForLoop(int &line_number, std::istringstream &iss)
+void Parser::endForLoop(int &line_number, Tokenizer &tokens)
 {
-    std::string check_extra;
-    iss>>check_extra;
-    pAssert(!(iss>>check_extra), "invalid syntax", line_number);
+    std::string_view check_extra;
+    tokens.word(check_extra);
+    pAssert(!tokens.word(check_extra), "invalid syntax", line_number);
     m_loops.back().endloop_line = line_number;
 }
 
+void Parser::checkpoint(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList)
+{
+    std::string_view check_extra;
+    pAssert(!tokens.word(check_extra), "invalid syntax", line_number);
+    gateList.push_back(std::make_unique<CheckpointGate>());
+}
+
+void Parser::observe(int &line_number, Tokenizer &tokens, int &nQ)
+{
+    std::vector<int> qs;
+    parseQubitList(line_number, qs, tokens, nQ);
+    pAssert(qs.size()>0, "Requires observed qubit(s)", line_number);
+    for (int q : qs)
+    {
+        if (std::find(m_observed.begin(), m_observed.end(), q) == m_observed.end()) {m_observed.push_back(q);}
+    }
+}
+
+void Parser::report(int &line_number, Tokenizer &tokens, Symbol symbol, int &nQ)
+{
+    ReportData data;
+    data.densityMatrix = (symbol == DENSITY_MATRIX);
+    parseQubitList(line_number, data.qubits, tokens, nQ);
+    pAssert(data.qubits.size()>0, "Requires qubit(s)", line_number);
+    pAssert(!data.densityMatrix || data.qubits.size()<=12, "rdm is limited to 12 qubits", line_number);
+    std::sort(data.qubits.begin(), data.qubits.end());
+    m_reports.push_back(data);
+}
+
 std::string Parser::replaceVar(std::string str, const std::string& from, const std::string& to) {
     size_t start_pos = 0;
     while((start_pos = str.find(from, start_pos)) != std::string::npos) {
@@ -399,46 +705,93 @@ std::string Parser::replaceVar(std::string str, const std::string& from, const s
     return str;
 }
 
-void Parser::parseControlQubits(int &line_number, std::vector<int> &cqs, std::istringstream &iss, int &nQ)
+void Parser::parseControlQubits(int &line_number, std::vector<int> &cqs, const std::vector<int> &aqs, Tokenizer &tokens, int &nQ)
 {
     double result;
     int cq;
-    std::string cqstr;
-    std::string cdstr;
-    iss>>cdstr;
+    std::string_view cqstr;
+    std::string_view cdstr;
+    tokens.word(cdstr);
     pAssert(cdstr=="|", "delimeter needs to be |", line_number);
-    while (iss>>cqstr)
+    while (tokens.word(cqstr))
     {
         result = eval(cqstr, line_number);
         pAssert(trunc(result)==result, "Control qubit number must be integer", line_number);
         cq = (int) result;
-        pAssert(cq>0 && cq<=nQ, "Control qubit numbers must be between 1 and "+std::to_string(nQ), line_number); 
-        pAssert(std::find(cqs.begin(), cqs.end(), cq) == cqs.end(), "Repeated control qubit - "+std::to_string(cq), line_number);   
+        if (cq<1 || cq>nQ) {pError("Control qubit numbers must be between 1 and "+std::to_string(nQ), line_number);}
+        if (std::find(cqs.begin(), cqs.end(), cq) != cqs.end()) {pError("Repeated control qubit - "+std::to_string(cq), line_number);}
+        if (std::find(aqs.begin(), aqs.end(), cq) != aqs.end()) {pError("Control qubit equals the target - "+std::to_string(cq), line_number);}
         cqs.push_back((int) result);
     }
     pAssert(cqs.size()>0, "Requires control qubit(s)", line_number);
 }
 
-void Parser::parseQubit(int &line_number, int &q, std::istringstream &iss, int &nQ)
+void Parser::parseQubit(int &line_number, int &q, Tokenizer &tokens, int &nQ)
 {
     double result;
-    std::string qstr;
-    pAssert(!(!(iss>>qstr)), "Requires active qubit", line_number);
+    std::string_view qstr;
+    pAssert(tokens.word(qstr), "Requires active qubit", line_number);
     result = eval(qstr, line_number);
     pAssert(trunc(result)==result, "Active qubit number must be integer", line_number);
     q = (int) result; 
-    pAssert(q>0 && q<=nQ, "Active qubit number must be between 1 and "+std::to_string(nQ), line_number);       
+    if (q<1 || q>nQ) {pError("Active qubit number must be between 1 and "+std::to_string(nQ), line_number);}
+}
+
+void Parser::parseQubitList(int &line_number, std::vector<int> &qs, Tokenizer &tokens, int &nQ)
+{
+    std::string_view qstr;
+    while (tokens.word(qstr))
+    {
+        Tokenizer qss(qstr);
+        int q;
+        parseQubit(line_number, q, qss, nQ);
+        if (std::find(qs.begin(), qs.end(), q) != qs.end()) {pError("Repeated qubit - "+std::to_string(q), line_number);}
+        qs.push_back(q);
+    }
 }
 
-void Parser::parseAngle(int &line_number, double &phi, std::istringstream &iss)
+void Parser::parseAngle(int &line_number, double &phi, Tokenizer &tokens)
 {
-    std::string astr;
-    pAssert(!(!(iss>>astr)), "Requires angle to be given", line_number);
+    std::string_view astr;
+    pAssert(tokens.word(astr), "Requires angle to be given", line_number);
     phi = eval(astr, line_number);
 }
 
-double Parser::eval(std::string expr, int &line_number)
+void Parser::parseProbability(int &line_number, double &p, Tokenizer &tokens)
+{
+    std::string_view pstr;
+    pAssert(tokens.word(pstr), "Requires probability to be given", line_number);
+    p = eval(pstr, line_number);
+    pAssert(p>=0.0 && p<=1.0, "Probability must be between 0 and 1", line_number);
+}
+
+double Parser::eval(std::string_view text, int &line_number)
 {
+    // Plain decimals, by far the most common operands, skip the expression parser, and short
+    // integers such as qubit numbers are read as they are scanned
+    bool negative = !text.empty() && text[0] == '-';
+    size_t digits = 0;
+    size_t points = 0;
+    long whole = 0;
+    size_t i = negative ? 1 : 0;
+    for (; i < text.length(); ++i)
+    {
+        if (text[i] >= '0' && text[i] <= '9')
+        {
+            ++digits;
+            whole = whole*10 + (text[i] - '0');
+        }
+        else if (text[i] == '.') {++points;}
+        else {break;}
+    }
+    if (i == text.length() && digits > 0 && points <= 1)
+    {
+        if (points == 0 && digits <= 9) {return negative ? -double(whole) : double(whole);}
+        double value;
+        std::from_chars(text.data(), text.data() + text.length(), value);
+        return value;
+    }
+    std::string expr(text);
     pAssert(expr.find('$') == std::string::npos, "Undefined variable", line_number);
     std::string xxx;
     for (int i = 0; i < expr.length(); i++)
@@ -503,14 +856,15 @@ double Parser::eval(std::string expr, int &line_number)
             return eval(tok.substr(0, i), line_number) / eval(tok.substr(i+1, tok.length()-i-1), line_number);
         }
     }
-    return std::stod(tok.c_str());
+    try
+    {
+        return std::stod(tok);
+    } catch (const std::logic_error &) {
+        pError("Invalid number - '"+tok+"'", line_number);
+    }
 }
 
-void Parser::pAssert(bool condition, std::string statement, int line_number)
+void Parser::pError(const std::string &statement, int line_number)
 {
-    if (!condition)
-    {
-        std::cerr<<statement<<" (line "<<line_number<<")"<<std::endl;
-        exit(1);
-    }
+    throw ParseError(statement+" (line "+std::to_string(line_number)+")");
 }
\ No newline at end of file
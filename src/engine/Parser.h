@@ -3,19 +3,37 @@
 
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <atomic>
 #include <algorithm>
 #include <iterator>
 #include <numeric>
+#include <stdexcept>
 #include "Gate.h"
 #include "CustomGate.h"
 #include "DefaultGate.h"
+#include "NoiseChannel.h"
+#include "Checkpoint.h"
+#include "UnitaryGate.h"
+#include "QftGate.h"
+#include "DiffusionGate.h"
+#include "SourceFile.h"
+#include "Tokenizer.h"
 
 const std::string NESTED_FUNC_SPLIT = "-";
 
+// Thrown for any error in a script, the message ends with the offending line
+class ParseError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
 enum Symbol {
     // Keywords
     INITIALISE,
@@ -23,6 +41,10 @@ enum Symbol {
     END_DEFINITION,
     FOR_LOOP,
     END_FOR_LOOP,
+    CHECKPOINT,
+    OBSERVE,
+    MARGINAL,
+    DENSITY_MATRIX,
     // Default Gates
     IDENTITY,
     HADAMARD,
@@ -42,9 +64,24 @@ enum Symbol {
     CONTROLLED_ROTATION_X,
     CONTROLLED_ROTATION_Y,
     CONTROLLED_ROTATION_Z,
+    // Default Multi-Angle Gates
+    U1_GATE,
+    U2_GATE,
+    U3_GATE,
+    CONTROLLED_U1_GATE,
+    CONTROLLED_U2_GATE,
+    CONTROLLED_U3_GATE,
     // Default Multi-Qubit Gates
     SWAP,
     CONTROLLED_SWAP,
+    UNITARY,
+    QFT,
+    INVERSE_QFT,
+    DIFFUSION,
+    // Noise Channels
+    DEPOLARIZING,
+    AMPLITUDE_DAMPING,
+    READOUT_ERROR,
     // Custom Gate
     CUSTOM,
     // Skip
@@ -58,6 +95,12 @@ struct DefinitionData
     std::vector<std::string> variables;
 };
 
+struct ReportData
+{
+    bool densityMatrix;
+    std::vector<int> qubits;
+};
+
 struct LoopData
 {
     int loop_line;
@@ -71,48 +114,77 @@ class Parser
 public:
 
     Parser();
-    void parse(std::vector<std::unique_ptr<Gate>> &m_gateList, int &nQ, std::vector<c> &qR);
+    void parse(std::vector<std::unique_ptr<Gate>> &m_gateList, int &nQ);
     void scanLines(std::string &filename);
+    void scanText(const std::string &text);
     void reset();
+    std::vector<int> observedQubits() {return m_observed;}
+    std::vector<ReportData> reports() {return m_reports;}
     ~Parser(){};
 
 private:
 
-    void parseLine(int &line_number, std::string &line, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR);
-    void formatLine(int &line_number,std::string &line);
-    void symHandler(int &line_number, std::istringstream &iss, Symbol &symbol, std::string &symbolstr);
+    int plainRegionEnd(int first);
+    bool isPlainLine(std::string_view line);
+    void parseRegion(int first, int last, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void checkReadout(std::vector<std::unique_ptr<Gate>> &gateList, std::vector<bool> &readout);
+    void parseLine(int &line_number, std::string_view line, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    std::string_view formatLine(int &line_number, std::string_view line, std::string &buffer);
+    void symHandler(int &line_number, Tokenizer &tokens, Symbol &symbol, std::string_view &symbolstr);
     void initialChecksHandler(int &line_number, Symbol &symbol);
-    void commandHandler(int &line_number, std::istringstream &iss, Symbol &symbol, std::string &symbolstr, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR);
-
-    void initialise(int &line_number, std::istringstream &iss, int &nQ, std::vector<c> &qR);
-    void definition(int &line_number, std::istringstream &iss);
-    void endDefinition(int &line_number, std::istringstream &iss);
-    void forLoop(int &line_number, std::istringstream &iss, std::vector<std::unique_ptr<Gate>> &gateList, int nQ, std::vector<c> &qR);
-    void endForLoop(int &line_number, std::istringstream &iss);
-    void defaultGate(int &line_number, std::istringstream &iss, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
-    void defaultAngleGate(int &line_number, std::istringstream &iss, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
-    void defaultMultiQubitGate(int &line_number, std::istringstream &iss, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
-    void customGate(int &line_number, std::istringstream &iss, std::string &sym, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ, std::vector<c> &qR);
+    void commandHandler(int &line_number, Tokenizer &tokens, Symbol &symbol, std::string_view &symbolstr, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+
+    void initialise(int &line_number, Tokenizer &tokens, int &nQ);
+    void definition(int &line_number, Tokenizer &tokens);
+    void endDefinition(int &line_number, Tokenizer &tokens);
+    void forLoop(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList, int nQ);
+    void endForLoop(int &line_number, Tokenizer &tokens);
+    void checkpoint(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList);
+    void observe(int &line_number, Tokenizer &tokens, int &nQ);
+    void report(int &line_number, Tokenizer &tokens, Symbol symbol, int &nQ);
+    void defaultGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void defaultAngleGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void defaultMultiAngleGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void unitaryGate(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void qftGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void diffusionGate(int &line_number, Tokenizer &tokens, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void defaultMultiQubitGate(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void noiseChannel(int &line_number, Tokenizer &tokens, Symbol symbol, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
+    void customGate(int &line_number, Tokenizer &tokens, std::string_view sym, std::vector<std::unique_ptr<Gate>> &gateList, int &nQ);
 
     std::string replaceVar(std::string str, const std::string &from, const std::string &to);
 
-    void parseControlQubits(int &line_number, std::vector<int> &cqs, std::istringstream &iss, int &nQ);
-    void parseQubit(int &line_number, int &q, std::istringstream &iss, int &nQ);
-    void parseAngle(int &line_number, double &phi, std::istringstream &iss); 
-
-    double eval(std::string expr, int &line_number);
-
-    void pAssert(bool condition, std::string statement, int line_number);
-
-    std::vector<std::string> m_lines;
-    std::map<std::string, DefinitionData> m_defs;
+    void parseControlQubits(int &line_number, std::vector<int> &cqs, const std::vector<int> &aqs, Tokenizer &tokens, int &nQ);
+    void parseQubit(int &line_number, int &q, Tokenizer &tokens, int &nQ);
+    void parseQubitList(int &line_number, std::vector<int> &qs, Tokenizer &tokens, int &nQ);
+    void parseAngle(int &line_number, double &phi, Tokenizer &tokens); 
+    void parseProbability(int &line_number, double &p, Tokenizer &tokens);
+
+    double eval(std::string_view text, int &line_number);
+
+    // The message is only built into a string once the check fails, checks run several times per line
+    void pAssert(bool condition, const char *statement, int line_number)
+    {
+        if (!condition) {pError(statement, line_number);}
+    }
+    [[noreturn]] void pError(const std::string &statement, int line_number);
+
+    // Lines are views into m_source, which owns or maps the script text
+    SourceFile m_source;
+    std::vector<std::string_view> m_lines;
+    std::map<std::string, DefinitionData, std::less<>> m_defs;
     std::vector<LoopData> m_loops;
     std::vector<std::pair<std::string,std::string>> m_vars;
     bool m_isInitialised;
     bool m_inDef;
     bool m_inLoop;
+    // Set by the workers of parseRegion too
+    std::atomic<bool> m_hasReadout;
     std::string m_currentDefName;
-    std::map<std::string, Symbol> m_symbol_map;
+    std::vector<int> m_observed;
+    std::vector<ReportData> m_reports;
+    // Looked up for every line. The keys view string literals or the names owned by m_defs
+    std::unordered_map<std::string_view, Symbol> m_symbol_map;
 };
 
 #endif
\ No newline at end of file
@@ -2,24 +2,107 @@
 #define Qcircuit_H
 
 #include "Parser.h"
+#include "Parallel.h"
+#include "Optimiser.h"
+#include "Reduction.h"
+#include "StateCache.h"
+#include "Distributed.h"
 
 typedef std::complex<double> c;
 
+enum Backend {
+    BACKEND_AUTO,
+    BACKEND_DENSE,
+    BACKEND_SPARSE
+};
+
 class Qcircuit
 {
 public:
     Qcircuit();
     void readFile(std::string filename);
+    void readScript(const std::string &script);
+    void clear();
+    void restart();
 	void run();
-    void printRegister();
-    std::string binary(int a, int n);
+    void printRegister(std::ostream &out = std::cout);
+    std::string binary(size_t a, int n);
+    void setTrajectories(int trajectories);
+    void setSeed(unsigned long long seed);
+    void setCheckpoint(std::string path, size_t every, bool compress);
+    void setResume(bool resume);
+    void setCache(StateCache *cache, size_t every);
+    void setBackend(Backend backend);
+    static bool backendFromName(const std::string &name, Backend &backend);
+    void setOptimisation(int level);
+    void setObserved(std::vector<int> observed);
+    // Runs the circuit once per computational basis input, lanes of them in one register
+    void setInputs(std::vector<size_t> inputs);
+    void setAllInputs();
+    void setLanes(unsigned lanes);
+    size_t inputCount() {return m_inputs.size();}
+    // Makes the output of input k the register read by marginal(), reducedDensityMatrix() and printing
+    void selectInput(size_t k);
+    void addReport(bool densityMatrix, std::vector<int> qubits);
+    std::vector<double> marginal(std::vector<int> qubits);
+    std::vector<c> reducedDensityMatrix(std::vector<int> qubits);
     //void addGate(Gate* gate);
     ~Qcircuit(){};
 private:
+    void compile();
+    void runTrajectories(size_t first);
+    size_t sparseLimit();
+    void requireDense(const std::string &reason);
+    void toDense(const std::string &gate);
+    static size_t countSupport(const Qregister &qregister, size_t limit);
+    void runBatched();
+#ifdef QATCH_MPI
+    void runDistributed();
+#endif
+
+    bool registerBits(const std::vector<int> &qubits, std::vector<int> &bits);
+    void printObserved(std::ostream &out);
+    void printReports(std::ostream &out);
+    void printSparse(std::ostream &out);
+    void printState(std::ostream &out);
+
 	int m_numQubits;
     std::vector<std::unique_ptr<Gate>> m_gateList;
-    std::vector<c> m_qregister;
+    Qregister m_qregister;
+    SparseRegister m_sparse;
+    Backend m_backend = BACKEND_AUTO;
+    bool m_sparseAllowed = false;
+    bool m_sparseActive = false;
+#ifdef QATCH_MPI
+    DistributedRegister m_distributed;
+    bool m_distributedActive = false;
+    // Set on the other ranks while rank 0 runs the circuit alone
+    bool m_idleRank = false;
+#endif
+    std::vector<double> m_probabilities;
+    bool m_noisy = false;
+    int m_trajectories = 1000;
+    unsigned long long m_seed;
+    Checkpointer m_checkpointer;
+    size_t m_checkpointEvery = 0;
+    bool m_resume = false;
+    StateCache *m_cache = nullptr;
+    size_t m_cacheEvery = 0;
+    std::vector<int> m_observed;
+    std::vector<size_t> m_inputs;
+    bool m_allInputs = false;
+    unsigned m_lanes;
+    // Outputs of the inputs other than the selected one, which is held in m_qregister
+    std::vector<Qregister> m_outputs;
+    size_t m_selected = 0;
+    std::vector<int> m_qubitMap;
+    std::vector<ReportData> m_reports;
+    // Outputs accumulated over trajectories when the circuit is noisy
+    std::vector<ReportData> m_accumulated;
+    std::vector<std::vector<double>> m_accumulatedProbabilities;
+    std::vector<std::vector<c>> m_accumulatedMatrices;
     Parser m_parser;
+    Optimiser m_optimiser;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,31 +1,621 @@
 #include "QCircuit.h"
+#include <algorithm>
+#include <numeric>
 
 typedef std::complex<double> c;
 
+// Widest register the dense backend will allocate (16 TiB)
+static const int MAX_DENSE_QUBITS = 40;
+// The sparse backend hands over to the dense one past 2^n / SPARSE_FRACTION basis states
+static const size_t SPARSE_FRACTION = 64;
+// Dense gates between checks whether the state became sparse again
+static const size_t SPARSE_CHECK_INTERVAL = 64;
+// Sparse states on more qubits print only their support
+static const int PRINT_ALL_QUBITS = 20;
+// Inputs simulated together in one register
+static const unsigned DEFAULT_LANES = 8;
+
 Qcircuit::Qcircuit()
 {
-    ;
+    m_seed = std::random_device{}();
+    m_lanes = DEFAULT_LANES;
 }
 
 void Qcircuit::readFile(std::string filename)
 {
     m_parser.scanLines(filename);
-    m_parser.parse(m_gateList, m_numQubits, m_qregister);
+    compile();
+}
+
+void Qcircuit::readScript(const std::string &script)
+{
+    m_parser.scanText(script);
+    compile();
+}
+
+// Forgets the circuit and its results, the parser and the register buffer are kept for reuse
+void Qcircuit::clear()
+{
+    m_parser.reset();
+    m_gateList.clear();
+    m_numQubits = 0;
+    m_observed.clear();
+    m_reports.clear();
+    m_qubitMap.clear();
+    m_inputs.clear();
+    m_allInputs = false;
+    m_lanes = DEFAULT_LANES;
+    m_outputs.clear();
+    m_noisy = false;
+    m_probabilities.clear();
+    m_accumulated.clear();
+    m_accumulatedProbabilities.clear();
+    m_accumulatedMatrices.clear();
+}
+
+// Drops the results so the compiled circuit can be run again, run() starts from |0...0>
+void Qcircuit::restart()
+{
+    m_outputs.clear();
+    m_noisy = false;
+    m_probabilities.clear();
+    m_accumulated.clear();
+    m_accumulatedProbabilities.clear();
+    m_accumulatedMatrices.clear();
+}
+
+void Qcircuit::compile()
+{
+    try
+    {
+        m_parser.parse(m_gateList, m_numQubits);
+    } catch (...) {
+        m_parser.reset();
+        throw;
+    }
+    // Qubits from options are checked like those of the observe instruction
+    for (size_t i=0; i<m_observed.size(); ++i)
+    {
+        if (std::find(m_observed.begin(), m_observed.begin()+i, m_observed[i]) != m_observed.begin()+i)
+        {
+            m_parser.reset();
+            throw ParseError("Repeated observed qubit - "+std::to_string(m_observed[i]));
+        }
+    }
+    for (auto &r : m_reports)
+    {
+        // Sorted by addReport, so a repeat sits next to its first occurrence
+        auto repeat = std::adjacent_find(r.qubits.begin(), r.qubits.end());
+        if (r.qubits.empty() || repeat != r.qubits.end() || (r.densityMatrix && r.qubits.size() > 12))
+        {
+            m_parser.reset();
+            if (r.qubits.empty()) {throw ParseError("Requires qubit(s)");}
+            if (repeat != r.qubits.end()) {throw ParseError("Repeated qubit - "+std::to_string(*repeat));}
+            throw ParseError("rdm is limited to 12 qubits");
+        }
+    }
+    for (int q : m_parser.observedQubits())
+    {
+        if (std::find(m_observed.begin(), m_observed.end(), q) == m_observed.end()) {m_observed.push_back(q);}
+    }
+    for (auto &r : m_parser.reports())
+    {
+        m_reports.push_back(r);
+    }
     m_parser.reset();
+    m_optimiser.resetRemoved();
+    m_qubitMap.resize(m_numQubits+1);
+    std::iota(m_qubitMap.begin(), m_qubitMap.end(), 0);
+    std::vector<int> seeds = m_observed;
+    for (auto &r : m_reports)
+    {
+        seeds.insert(seeds.end(), r.qubits.begin(), r.qubits.end());
+    }
+    for (int q : seeds)
+    {
+        if (q < 1 || q > m_numQubits)
+        {
+            throw ParseError("Output qubit "+std::to_string(q)+" must be between 1 and "+std::to_string(m_numQubits));
+        }
+    }
+    if (!m_observed.empty())
+    {
+        // Simulate only the light cone, on a register of the qubits it still uses
+        std::sort(m_observed.begin(), m_observed.end());
+        m_qubitMap = m_optimiser.pruneLightCone(m_gateList, seeds, m_numQubits);
+        m_numQubits = *std::max_element(m_qubitMap.begin(), m_qubitMap.end());
+    }
+    m_optimiser.optimise(m_gateList);
+    m_optimiser.report();
 }
 
 void Qcircuit::run()
 {
-    for (auto&& g : m_gateList)
+    m_outputs.clear();
+#ifdef QATCH_MPI
+    // Circuits the split register cannot run go to rank 0 alone, the other ranks print nothing
+    m_distributedActive = false;
+    m_idleRank = false;
+    if (DistributedRegister::processes() > 1)
+    {
+        bool batched = m_allInputs || !m_inputs.empty();
+        bool noisy = std::any_of(m_gateList.begin(), m_gateList.end(), [](const std::unique_ptr<Gate> &g) {return g->isNoisy();});
+        if (!batched && !noisy && DistributedRegister::splits(m_numQubits, m_gateList))
+        {
+            m_distributedActive = true;
+            runDistributed();
+            return;
+        }
+        if (DistributedRegister::rank() != 0)
+        {
+            m_idleRank = true;
+            return;
+        }
+        std::cerr<<(batched ? "Batched inputs run" : noisy ? "Noise channels run" : "A register of "+std::to_string(m_numQubits)+" qubits is too small to split, it runs")
+            <<" on rank 0 alone"<<std::endl;
+    }
+#endif
+    if (m_allInputs || !m_inputs.empty())
+    {
+        runBatched();
+        return;
+    }
+    size_t first = 0;
+    // Checkpoints and the state cache work on the dense register
+    m_sparseAllowed = m_backend != BACKEND_DENSE && !m_resume && !m_checkpointEvery && !(m_cache && m_cache->enabled());
+    m_sparseActive = m_sparseAllowed;
+    if (m_sparseActive)
+    {
+        m_sparse.reset(m_numQubits);
+    } else {
+        requireDense("the dense backend");
+        resetRegister(m_qregister, size_t(1) << m_numQubits);
+    }
+    // Identifies the compiled circuit in its checkpoints
+    uint64_t circuitHash = 0;
+    if (m_resume || m_checkpointEvery || std::any_of(m_gateList.begin(), m_gateList.end(), [](const std::unique_ptr<Gate> &g) {return g->isCheckpoint();}))
+    {
+        circuitHash = StateCache::prefixHashes(m_gateList, m_numQubits).back();
+    }
+    if (m_resume)
     {
-        g->act(m_qregister);
+        if (!m_checkpointer.load(m_qregister, m_numQubits, first, m_gateList.size(), circuitHash))
+        {
+            std::cerr<<"No usable checkpoint, starting from the beginning"<<std::endl;
+            first = 0;
+            resetRegister(m_qregister, m_qregister.size());
+        }
+    }
+    // The noise-free prefix is shared by every trajectory
+    size_t prefix = first;
+    while (prefix < m_gateList.size() && !m_gateList[prefix]->isNoisy())
+    {
+        ++prefix;
+    }
+    std::vector<uint64_t> hashes;
+    if (m_cache && m_cache->enabled())
+    {
+        hashes = StateCache::prefixHashes(m_gateList, m_numQubits);
+        if (first == 0)
+        {
+            first = m_cache->resume(m_qregister, m_numQubits, hashes, prefix);
+            if (first > 0) {std::cerr<<"Resumed from the cached state after "<<first<<" gates"<<std::endl;}
+        }
+    }
+    size_t sinceCheck = 0;
+    while (first < prefix)
+    {
+        Gate *gate = m_gateList[first].get();
+        if (!m_sparseActive || !gate->actSparse(m_sparse))
+        {
+            if (m_sparseActive) {toDense(gate->name());}
+            gate->act(m_qregister);
+        }
+        ++first;
+        if (m_backend == BACKEND_AUTO && m_sparseAllowed)
+        {
+            // The dense support is only counted every few gates, sparse runs check every gate
+            if (m_sparseActive && m_sparse.support() > sparseLimit())
+            {
+                toDense(gate->name());
+            } else if (!m_sparseActive && ++sinceCheck == SPARSE_CHECK_INTERVAL) {
+                sinceCheck = 0;
+                if (countSupport(m_qregister, sparseLimit()/4) <= sparseLimit()/4)
+                {
+                    m_sparse.fromDense(m_qregister);
+                    m_sparseActive = true;
+                }
+            }
+        }
+        bool checkpoint = m_gateList[first-1]->isCheckpoint();
+        if (checkpoint || (m_checkpointEvery && first % m_checkpointEvery == 0))
+        {
+            m_checkpointer.save(m_qregister, m_numQubits, first, m_gateList.size(), circuitHash);
+        }
+        if (!hashes.empty() && (checkpoint || first == prefix || (m_cacheEvery && first % m_cacheEvery == 0)))
+        {
+            m_cache->store(m_qregister, m_numQubits, first, hashes[first]);
+        }
+    }
+    m_checkpointer.wait();
+    m_noisy = (first < m_gateList.size());
+    if (m_noisy)
+    {
+        if (m_sparseActive) {toDense(m_gateList[first]->name());}
+        runTrajectories(first);
     }
 }
 
-std::string Qcircuit::binary(int a, int n)
+// Interleaves the outputs of up to m_lanes inputs amplitude by amplitude: the lanes are the
+// lowest bits of the register and qubit q moves to bit q-1+laneBits. Every gate then works on
+// runs of at least m_lanes contiguous amplitudes with the same matrix, so its coefficients are
+// loaded once for all lanes and the inner loops vectorise across them.
+void Qcircuit::runBatched()
+{
+    for (auto &gate : m_gateList)
+    {
+        if (gate->isNoisy()) {throw std::runtime_error("Noise channels cannot be batched over inputs");}
+    }
+    int originalQubits = (int)m_qubitMap.size() - 1;
+    // Every output is kept, so all of them together must fit where one dense register would
+    if (m_allInputs)
+    {
+        if (originalQubits + m_numQubits > MAX_DENSE_QUBITS)
+        {
+            throw std::runtime_error("The outputs of all "+std::to_string(originalQubits)+"-qubit inputs are too large to keep");
+        }
+        m_inputs.resize(size_t(1) << originalQubits);
+        std::iota(m_inputs.begin(), m_inputs.end(), 0);
+    }
+    for (size_t input : m_inputs)
+    {
+        if (originalQubits < 64 && (input >> originalQubits) != 0)
+        {
+            throw std::runtime_error("Input "+std::to_string(input)+" does not fit the "+std::to_string(originalQubits)+" qubits of the circuit");
+        }
+    }
+    if (m_numQubits > MAX_DENSE_QUBITS || m_inputs.size() > (size_t(1) << (MAX_DENSE_QUBITS - m_numQubits)))
+    {
+        throw std::runtime_error("The outputs of "+std::to_string(m_inputs.size())+" inputs on "+std::to_string(m_numQubits)+" qubits are too large to keep");
+    }
+    int laneBits = 0;
+    while ((size_t(1) << laneBits) < std::min<size_t>(m_inputs.size(), m_lanes)) {++laneBits;}
+    size_t lanes = size_t(1) << laneBits;
+    m_numQubits += laneBits;
+    requireDense("a batch of "+std::to_string(lanes)+" inputs");
+    m_numQubits -= laneBits;
+    std::vector<int> shift(m_numQubits+1, 0);
+    std::vector<int> back(m_numQubits+laneBits+1, 0);
+    for (int q=1; q<=m_numQubits; ++q)
+    {
+        shift[q] = q+laneBits;
+        back[q+laneBits] = q;
+    }
+    for (auto &gate : m_gateList)
+    {
+        gate->remap(shift);
+    }
+    m_outputs.assign(m_inputs.size(), Qregister());
+    size_t size = size_t(1) << m_numQubits;
+    for (size_t start=0; start<m_inputs.size(); start+=lanes)
+    {
+        resetRegister(m_qregister, size << laneBits);
+        m_qregister[0] = c(0.0, 0.0);
+        size_t count = std::min(lanes, m_inputs.size()-start);
+        for (size_t l=0; l<count; ++l)
+        {
+            // Input bits of qubits outside the light cone cannot change the outputs
+            size_t input = 0;
+            for (int q=1; q<=originalQubits; ++q)
+            {
+                if (((m_inputs[start+l] >> (q-1)) & 1) && m_qubitMap[q]) {input |= size_t(1) << (m_qubitMap[q]-1);}
+            }
+            m_qregister[(input << laneBits) | l] = c(1.0, 0.0);
+        }
+        for (auto &gate : m_gateList)
+        {
+            if (!gate->isCheckpoint()) {gate->act(m_qregister);}
+        }
+        for (size_t l=0; l<count; ++l)
+        {
+            Qregister &output = m_outputs[start+l];
+            resetRegister(output, size);
+            parallelFor(size, [&](size_t begin, size_t end, unsigned)
+            {
+                for (size_t n=begin; n<end; ++n) {output[n] = m_qregister[(n << laneBits) | l];}
+            }, 4096);
+        }
+    }
+    for (auto &gate : m_gateList)
+    {
+        gate->remap(back);
+    }
+    m_noisy = false;
+    m_sparseActive = false;
+    m_selected = 0;
+    std::swap(m_qregister, m_outputs[0]);
+    Qregister().swap(m_outputs[0]);
+}
+
+void Qcircuit::selectInput(size_t k)
+{
+    if (k == m_selected || k >= m_outputs.size()) {return;}
+    std::swap(m_qregister, m_outputs[m_selected]);
+    std::swap(m_qregister, m_outputs[k]);
+    m_selected = k;
+}
+
+#ifdef QATCH_MPI
+// Noise-free circuits on a register split over the MPI processes. Checkpoints and the state
+// cache are skipped, the full output is gathered on rank 0 and the reports are reductions.
+void Qcircuit::runDistributed()
+{
+    m_distributed.reset(m_numQubits, m_gateList);
+    m_distributed.run(m_gateList, 0, m_gateList.size());
+    m_noisy = false;
+    m_sparseActive = false;
+    if (m_observed.empty())
+    {
+        requireDense("the gathered output");
+        m_distributed.gather(m_qregister);
+    } else {
+        Qregister().swap(m_qregister);
+    }
+    if (DistributedRegister::rank() == 0)
+    {
+        std::cerr<<"Distributed over "<<DistributedRegister::processes()<<" processes with "
+            <<m_distributed.exchanges()<<" chunk exchanges"<<std::endl;
+    }
+}
+#endif
+
+// Largest support kept sparse, past it the dense kernels are faster
+size_t Qcircuit::sparseLimit()
+{
+    if (m_backend == BACKEND_SPARSE || m_numQubits > MAX_DENSE_QUBITS) {return SIZE_MAX;}
+    return std::max<size_t>((size_t(1) << m_numQubits) / SPARSE_FRACTION, 1);
+}
+
+void Qcircuit::requireDense(const std::string &reason)
+{
+    if (m_numQubits > MAX_DENSE_QUBITS)
+    {
+        throw std::runtime_error("A dense register of "+std::to_string(m_numQubits)+" qubits is too large for "+reason);
+    }
+}
+
+// Moves the state into the dense register, for a gate without a sparse kernel or a wide support
+void Qcircuit::toDense(const std::string &gate)
+{
+    requireDense("gate '"+gate+"'");
+    m_sparse.toDense(m_qregister);
+    m_sparseActive = false;
+}
+
+// Nonzero amplitudes of the register, counting stops somewhere past limit
+size_t Qcircuit::countSupport(const Qregister &qregister, size_t limit)
+{
+    std::vector<size_t> counts(parallelWorkers(), 0);
+    parallelFor(qregister.size(), [&](size_t begin, size_t end, unsigned worker)
+    {
+        size_t count = 0;
+        for (size_t n=begin; n<end && count<=limit; ++n)
+        {
+            if (qregister[n] != c(0.0, 0.0)) {++count;}
+        }
+        counts[worker] = count;
+    }, 1 << 16);
+    size_t total = 0;
+    for (size_t n : counts)
+    {
+        total += n;
+    }
+    return total;
+}
+
+void Qcircuit::runTrajectories(size_t first)
+{
+    // The full distribution is only kept when no qubits are observed, otherwise just the outputs
+    bool full = m_observed.empty();
+    m_accumulated = m_reports;
+    if (!full) {m_accumulated.push_back({false, m_observed});}
+    std::vector<std::vector<int>> bits(m_accumulated.size());
+    for (size_t a=0; a<m_accumulated.size(); ++a)
+    {
+        registerBits(m_accumulated[a].qubits, bits[a]);
+    }
+    std::vector<std::vector<double>> partial(parallelWorkers());
+    std::vector<std::vector<std::vector<double>>> partialProbabilities(parallelWorkers());
+    std::vector<std::vector<std::vector<c>>> partialMatrices(parallelWorkers());
+    parallelFor(m_trajectories, [&](size_t begin, size_t end, unsigned worker)
+    {
+        std::vector<double> &probs = partial[worker];
+        probs.assign(full ? m_qregister.size() : 0, 0.0);
+        partialProbabilities[worker].resize(m_accumulated.size());
+        partialMatrices[worker].resize(m_accumulated.size());
+        Qregister reg;
+        for (size_t t=begin; t<end; ++t)
+        {
+            // Independent stream per trajectory, so results do not depend on the worker count
+            std::seed_seq seq{(unsigned)(m_seed), (unsigned)(m_seed >> 32), (unsigned)t};
+            std::mt19937_64 rng(seq);
+            reg = m_qregister;
+            for (size_t i=first; i<m_gateList.size(); ++i)
+            {
+                m_gateList[i]->actTrajectory(reg, rng);
+            }
+            for (size_t n=0; n<probs.size(); ++n)
+            {
+                probs[n] += std::norm(reg[n]);
+            }
+            for (size_t a=0; a<m_accumulated.size(); ++a)
+            {
+                if (m_accumulated[a].densityMatrix)
+                {
+                    std::vector<c> rho = ::reducedDensityMatrix(reg, bits[a]);
+                    std::vector<c> &acc = partialMatrices[worker][a];
+                    acc.resize(rho.size());
+                    for (size_t k=0; k<rho.size(); ++k) {acc[k] += rho[k];}
+                } else {
+                    std::vector<double> p = marginalProbabilities(reg, bits[a]);
+                    std::vector<double> &acc = partialProbabilities[worker][a];
+                    acc.resize(p.size());
+                    for (size_t k=0; k<p.size(); ++k) {acc[k] += p[k];}
+                }
+            }
+        }
+    });
+    m_probabilities.assign(full ? m_qregister.size() : 0, 0.0);
+    for (auto &probs : partial)
+    {
+        for (size_t n=0; n<probs.size(); ++n)
+        {
+            m_probabilities[n] += probs[n]/m_trajectories;
+        }
+    }
+    m_accumulatedProbabilities.assign(m_accumulated.size(), {});
+    m_accumulatedMatrices.assign(m_accumulated.size(), {});
+    for (unsigned w=0; w<partial.size(); ++w)
+    {
+        for (size_t a=0; a<m_accumulated.size() && !partialProbabilities[w].empty(); ++a)
+        {
+            std::vector<double> &p = partialProbabilities[w][a];
+            std::vector<c> &rho = partialMatrices[w][a];
+            m_accumulatedProbabilities[a].resize(std::max(m_accumulatedProbabilities[a].size(), p.size()), 0.0);
+            m_accumulatedMatrices[a].resize(std::max(m_accumulatedMatrices[a].size(), rho.size()), c(0.0, 0.0));
+            for (size_t k=0; k<p.size(); ++k) {m_accumulatedProbabilities[a][k] += p[k]/m_trajectories;}
+            for (size_t k=0; k<rho.size(); ++k) {m_accumulatedMatrices[a][k] += rho[k]/(double)m_trajectories;}
+        }
+    }
+}
+
+void Qcircuit::setTrajectories(int trajectories)
+{
+    m_trajectories = trajectories;
+}
+
+void Qcircuit::setSeed(unsigned long long seed)
+{
+    m_seed = seed;
+}
+
+void Qcircuit::setCheckpoint(std::string path, size_t every, bool compress)
+{
+    m_checkpointer.setPath(path);
+    m_checkpointer.setCompress(compress);
+    m_checkpointEvery = every;
+}
+
+void Qcircuit::setBackend(Backend backend)
+{
+    m_backend = backend;
+}
+
+bool Qcircuit::backendFromName(const std::string &name, Backend &backend)
+{
+    if (name == "auto") {backend = BACKEND_AUTO;}
+    else if (name == "dense") {backend = BACKEND_DENSE;}
+    else if (name == "sparse") {backend = BACKEND_SPARSE;}
+    else {return false;}
+    return true;
+}
+
+void Qcircuit::setCache(StateCache *cache, size_t every)
+{
+    m_cache = cache;
+    m_cacheEvery = every;
+}
+
+void Qcircuit::setResume(bool resume)
+{
+    m_resume = resume;
+}
+
+void Qcircuit::setInputs(std::vector<size_t> inputs)
+{
+    m_inputs = inputs;
+    m_allInputs = false;
+}
+
+void Qcircuit::setAllInputs()
+{
+    m_allInputs = true;
+}
+
+void Qcircuit::setLanes(unsigned lanes)
+{
+    m_lanes = std::max(1u, lanes);
+}
+
+void Qcircuit::setObserved(std::vector<int> observed)
+{
+    m_observed = observed;
+}
+
+void Qcircuit::addReport(bool densityMatrix, std::vector<int> qubits)
+{
+    std::sort(qubits.begin(), qubits.end());
+    m_reports.push_back({densityMatrix, qubits});
+}
+
+// Register bit positions of the given qubits, false if the light cone dropped one of them
+bool Qcircuit::registerBits(const std::vector<int> &qubits, std::vector<int> &bits)
+{
+    bits.clear();
+    for (int q : qubits)
+    {
+        if (q < 1 || q >= (int)m_qubitMap.size() || m_qubitMap[q] == 0) {return false;}
+        bits.push_back(m_qubitMap[q]-1);
+    }
+    return true;
+}
+
+// Marginal distribution of the qubits, the lowest qubit is the least significant bit of the index
+std::vector<double> Qcircuit::marginal(std::vector<int> qubits)
+{
+    std::sort(qubits.begin(), qubits.end());
+    std::vector<int> bits;
+    if (!registerBits(qubits, bits)) {return {};}
+#ifdef QATCH_MPI
+    if (m_distributedActive) {return m_distributed.marginal(bits);}
+#endif
+    if (!m_noisy && m_sparseActive) {return marginalProbabilities(m_sparse, bits);}
+    if (!m_noisy) {return marginalProbabilities(m_qregister, bits);}
+    if (!m_probabilities.empty()) {return marginalProbabilities(m_probabilities, bits);}
+    for (size_t a=0; a<m_accumulated.size(); ++a)
+    {
+        if (!m_accumulated[a].densityMatrix && m_accumulated[a].qubits == qubits) {return m_accumulatedProbabilities[a];}
+    }
+    return {};
+}
+
+// Reduced density matrix of the qubits, noisy circuits only have the ones requested before run()
+std::vector<c> Qcircuit::reducedDensityMatrix(std::vector<int> qubits)
+{
+    std::sort(qubits.begin(), qubits.end());
+    std::vector<int> bits;
+    if (!registerBits(qubits, bits)) {return {};}
+#ifdef QATCH_MPI
+    if (m_distributedActive) {return m_distributed.reducedDensityMatrix(bits);}
+#endif
+    if (!m_noisy && m_sparseActive) {return ::reducedDensityMatrix(m_sparse, bits);}
+    if (!m_noisy) {return ::reducedDensityMatrix(m_qregister, bits);}
+    for (size_t a=0; a<m_accumulated.size(); ++a)
+    {
+        if (m_accumulated[a].densityMatrix && m_accumulated[a].qubits == qubits) {return m_accumulatedMatrices[a];}
+    }
+    return {};
+}
+
+void Qcircuit::setOptimisation(int level)
+{
+    m_optimiser.setLevel(level);
+}
+
+std::string Qcircuit::binary(size_t a, int n)
 {
     std::string b{""};
-    int mask = 1;
+    size_t mask = 1;
     for(int i{}; i < n; i++)
     {
         if (mask & a)
@@ -39,27 +629,172 @@ std::string Qcircuit::binary(int a, int n)
     return b;
 };
 
-void Qcircuit::printRegister()
+void Qcircuit::printObserved(std::ostream &out)
+{
+    std::vector<double> probabilities = marginal(m_observed);
+    double mod = 0;
+    for (double p : probabilities)
+    {
+        mod += p;
+    }
+    out<<std::endl<<"Observed qubits";
+    for (int q : m_observed)
+    {
+        out<<" "<<q;
+    }
+    out<<std::endl;
+    if (m_noisy)
+    {
+        out<<"Averaged over "<<m_trajectories<<" trajectories"<<std::endl;
+    }
+    out<<std::endl;
+    for(size_t i=0;i<probabilities.size();i++)
+    {
+        out<<"P("<<i
+            <<") = "
+            <<probabilities[i]/mod
+            <<std::endl;
+    }
+}
+
+void Qcircuit::printReports(std::ostream &out)
+{
+    for (auto &r : m_reports)
+    {
+        out<<std::endl<<(r.densityMatrix ? "Reduced density matrix" : "Marginal")<<" qubits";
+        for (int q : r.qubits)
+        {
+            out<<" "<<q;
+        }
+        out<<std::endl;
+        if (!r.densityMatrix)
+        {
+            std::vector<double> probabilities = marginal(r.qubits);
+            double mod = 0;
+            for (double p : probabilities) {mod += p;}
+            for(size_t i=0;i<probabilities.size();i++)
+            {
+                out<<"P("<<i<<") = "<<probabilities[i]/mod<<std::endl;
+            }
+            continue;
+        }
+        std::vector<c> rho = reducedDensityMatrix(r.qubits);
+        size_t dim = size_t(1) << r.qubits.size();
+        for (size_t row=0; row<dim && rho.size()==dim*dim; ++row)
+        {
+            for (size_t col=0; col<dim; ++col)
+            {
+                c weight = rho[row*dim + col];
+                out<<(col ? " " : "")<<real(weight)
+                    <<(imag(weight) >= 0.0 ? "+" : "")
+                    <<imag(weight)<<"i";
+            }
+            out<<std::endl;
+        }
+    }
+}
+
+// Small registers list every basis state like the dense backend, larger ones only the support
+void Qcircuit::printSparse(std::ostream &out)
 {
+    std::vector<std::pair<uint64_t, c>> entries;
+    if (m_numQubits <= PRINT_ALL_QUBITS)
+    {
+        for (uint64_t n=0; n<(uint64_t(1) << m_numQubits); ++n)
+        {
+            entries.push_back({n, m_sparse.get(n)});
+        }
+    } else {
+        entries = m_sparse.entries();
+    }
+    double mod = 0;
+    out<<std::endl;
+    for (auto &e : entries)
+    {
+        mod += std::norm(e.second);
+        out<<real(e.second)
+            <<(imag(e.second) >= 0.0 ? "+" : "")
+            <<imag(e.second)<<"i"
+            <<" |"<<binary(e.first, m_numQubits)<<"> +"
+            <<std::endl;
+    }
+    out<<std::endl;
+    for (auto &e : entries)
+    {
+        out<<"P("<<e.first
+            <<") = "
+            <<std::norm(e.second)/mod
+            <<std::endl;
+    }
+}
+
+void Qcircuit::printRegister(std::ostream &out)
+{
+#ifdef QATCH_MPI
+    if (m_idleRank) {return;}
+    // Every process takes part in the reductions behind the reports, only rank 0 prints
+    if (m_distributedActive && DistributedRegister::rank() != 0)
+    {
+        std::ostringstream discarded;
+        printState(discarded);
+        return;
+    }
+#endif
+    if (m_outputs.empty())
+    {
+        printState(out);
+        return;
+    }
+    int originalQubits = (int)m_qubitMap.size() - 1;
+    for (size_t k=0; k<m_outputs.size(); ++k)
+    {
+        selectInput(k);
+        out<<(k ? "\n" : "")<<"Input |"<<binary(m_inputs[k], originalQubits)<<">"<<std::endl;
+        printState(out);
+    }
+}
+
+void Qcircuit::printState(std::ostream &out)
+{
+    if (!m_observed.empty())
+    {
+        printObserved(out);
+        printReports(out);
+        return;
+    }
+    if (!m_noisy && m_sparseActive)
+    {
+        printSparse(out);
+        printReports(out);
+        return;
+    }
     c weight;
-    double mod;
-    std::cout<<std::endl;
-    for(int i{};i<m_qregister.size();i++)
+    double mod = 0;
+    out<<std::endl;
+    for(int i{};i<m_qregister.size() && !m_noisy;i++)
     {
         weight = m_qregister[i];
-        std::cout<<real(weight) 
+        out<<real(weight) 
             <<(imag(weight) >= 0.0 ? "+" : "")
             <<imag(weight)<<"i"
             <<" |"<<binary(i, m_numQubits)<<"> +"
             <<std::endl;
-        mod += pow(abs(m_qregister[i]),2);
     }
-    std::cout<<std::endl;
+    if (m_noisy)
+    {
+        out<<"Averaged over "<<m_trajectories<<" trajectories"<<std::endl;
+    }
+    for(int i{};i<m_qregister.size();i++)
+    {
+        mod += m_noisy ? m_probabilities[i] : std::norm(m_qregister[i]);
+    }
+    out<<std::endl;
     for(int i{};i<m_qregister.size();i++)
     {
-        std::cout<<"P("<<i
+        out<<"P("<<i
             <<") = "
-            <<pow(abs(m_qregister[i]),2)/mod
+            <<(m_noisy ? m_probabilities[i] : std::norm(m_qregister[i]))/mod
             <<std::endl;
     }
+    printReports(out);
 };
\ No newline at end of file
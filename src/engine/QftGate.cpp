@@ -0,0 +1,163 @@
+#include "QftGate.h"
+#include "Parallel.h"
+#include <cmath>
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+const double pi = acos(-1.0);
+
+QftGate::QftGate(int lowQubit, int highQubit, bool inverse)
+{
+    m_name = inverse ? "IQFT" : "QFT";
+    m_lowQubit = lowQubit;
+    m_highQubit = highQubit;
+    m_inverse = inverse;
+    m_bits = highQubit - lowQubit + 1;
+    m_points = size_t(1) << m_bits;
+    m_stride = size_t(1) << (lowQubit-1);
+    // The m_points/2 twiddles split into a fine table for the low bits of k and a coarse one for the rest
+    double sign = inverse ? -1.0 : 1.0;
+    m_fineBits = (m_bits-1)/2;
+    m_fine.resize(size_t(1) << m_fineBits);
+    for (size_t k=0; k<m_fine.size(); ++k)
+    {
+        m_fine[k] = std::polar(1.0, sign*2*pi*k/m_points);
+    }
+    m_coarse.resize((m_points/2) >> m_fineBits);
+    for (size_t k=0; k<m_coarse.size(); ++k)
+    {
+        m_coarse[k] = std::polar(1.0, sign*2*pi*(k << m_fineBits)/m_points);
+    }
+}
+
+std::vector<int> QftGate::qubits()
+{
+    std::vector<int> qs;
+    for (int q=m_lowQubit; q<=m_highQubit; ++q)
+    {
+        qs.push_back(q);
+    }
+    return qs;
+}
+
+// The range stays contiguous as long as every qubit in it is kept
+void QftGate::remap(const std::vector<int> &map)
+{
+    *this = QftGate(map[m_lowQubit], map[m_highQubit], m_inverse);
+}
+
+static size_t reverseBits(size_t x, int bits)
+{
+    size_t r = 0;
+    for (int b=0; b<bits; ++b)
+    {
+        r = (r << 1) | ((x >> b) & 1);
+    }
+    return r;
+}
+
+// Swaps the rows begin..end-1 with their bit reversed rows, the reversed index is counted up alongside
+void QftGate::reverseRows(c *block, size_t begin, size_t end)
+{
+    size_t r = reverseBits(begin, m_bits);
+    for (size_t x=begin; x<end; ++x)
+    {
+        if (x < r) {std::swap_ranges(block + x*m_stride, block + (x+1)*m_stride, block + r*m_stride);}
+        size_t bit = m_points >> 1;
+        while (r & bit)
+        {
+            r ^= bit;
+            bit >>= 1;
+        }
+        r |= bit;
+    }
+}
+
+// Butterflies begin..end-1 of the stage of length 2^lenBits, rows are m_stride contiguous amplitudes
+// so the inner loop streams through memory whatever the position of the qubit range
+void QftGate::stage(c *block, int lenBits, size_t begin, size_t end, double scale)
+{
+    size_t half = size_t(1) << (lenBits-1);
+    int shift = m_bits - lenBits;
+    size_t j = begin & (half-1);
+    c *u = block + (((begin >> (lenBits-1)) << lenBits) + j)*m_stride;
+    for (size_t pair=begin; pair<end; ++pair)
+    {
+        c *v = u + half*m_stride;
+        c tw = twiddle(j << shift);
+        if (scale == 1.0)
+        {
+            for (size_t i=0; i<m_stride; ++i)
+            {
+                c t = v[i]*tw;
+                v[i] = u[i] - t;
+                u[i] += t;
+            }
+        }
+        else
+        {
+            tw *= scale;
+            for (size_t i=0; i<m_stride; ++i)
+            {
+                c t = v[i]*tw;
+                c s = u[i]*scale;
+                v[i] = s - t;
+                u[i] = s + t;
+            }
+        }
+        // The next group starts after the v rows of this one
+        u += m_stride;
+        if (++j == half)
+        {
+            j = 0;
+            u += half*m_stride;
+        }
+    }
+}
+
+void QftGate::transformBlock(c *block)
+{
+    reverseRows(block, 0, m_points);
+    double norm = 1.0/std::sqrt((double)m_points);
+    for (int lenBits=1; lenBits<=m_bits; ++lenBits)
+    {
+        stage(block, lenBits, 0, m_points/2, (lenBits == m_bits) ? norm : 1.0);
+    }
+}
+
+void QftGate::act(Qregister &qregister)
+{
+    size_t blockSize = m_points*m_stride;
+    size_t blocks = qregister.size()/blockSize;
+    if (blocks >= parallelWorkers())
+    {
+        // Independent transforms, each thread keeps its blocks in cache for every stage
+        parallelFor(blocks, [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t b=begin; b<end; ++b)
+            {
+                transformBlock(qregister.data() + b*blockSize);
+            }
+        });
+        return;
+    }
+    // Few large transforms, parallelise inside each stage instead
+    for (size_t b=0; b<blocks; ++b)
+    {
+        c *block = qregister.data() + b*blockSize;
+        parallelFor(m_points, [&](size_t begin, size_t end, unsigned)
+        {
+            reverseRows(block, begin, end);
+        }, 64);
+        double norm = 1.0/std::sqrt((double)m_points);
+        for (int lenBits=1; lenBits<=m_bits; ++lenBits)
+        {
+            double scale = (lenBits == m_bits) ? norm : 1.0;
+            parallelFor(m_points/2, [&](size_t begin, size_t end, unsigned)
+            {
+                stage(block, lenBits, begin, end, scale);
+            }, std::max<size_t>(1, 4096/m_stride));
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef QftGate_H
+#define QftGate_H
+
+#include "Gate.h"
+
+// Quantum Fourier transform over the contiguous qubits low..high (low is the least
+// significant bit), executed as a batched radix-2 FFT over the corresponding index stride
+class QftGate : public Gate
+{
+public:
+	QftGate(int lowQubit, int highQubit, bool inverse);
+	void act(Qregister &qregister);
+	std::vector<int> qubits();
+	void remap(const std::vector<int> &map);
+	int lowQubit() {return m_lowQubit;}
+	int highQubit() {return m_highQubit;}
+	bool isInverse() {return m_inverse;}
+protected:
+	c twiddle(size_t k) {return m_coarse[k >> m_fineBits]*m_fine[k & (m_fine.size()-1)];}
+	void transformBlock(c *block);
+	void reverseRows(c *block, size_t begin, size_t end);
+	void stage(c *block, int lenBits, size_t begin, size_t end, double scale);
+
+	int m_lowQubit;
+	int m_highQubit;
+	bool m_inverse;
+	int m_bits;
+	size_t m_points;
+	size_t m_stride;
+	// The twiddle k is m_coarse[k >> m_fineBits]*m_fine[k & mask], about sqrt(m_points) values
+	int m_fineBits;
+	std::vector<c> m_coarse;
+	std::vector<c> m_fine;
+};
+
+#endif
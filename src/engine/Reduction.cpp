@@ -0,0 +1,179 @@
+#include "Reduction.h"
+#include "Parallel.h"
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+static const int GROUP_BITS = 8;
+static const size_t GROUP_SIZE = size_t(1) << GROUP_BITS;
+
+// Per byte of the basis index, the bits it contributes to the marginal index
+static std::vector<std::vector<size_t>> gatherTables(size_t size, const std::vector<int> &bits)
+{
+    int indexBits = 0;
+    while ((size_t(1) << indexBits) < size) {++indexBits;}
+    std::vector<std::vector<size_t>> tables((indexBits + GROUP_BITS - 1)/GROUP_BITS, std::vector<size_t>(GROUP_SIZE, 0));
+    for (size_t g=0; g<tables.size(); ++g)
+    {
+        for (size_t byte=0; byte<GROUP_SIZE; ++byte)
+        {
+            for (size_t j=0; j<bits.size(); ++j)
+            {
+                int b = bits[j] - GROUP_BITS*g;
+                if (b >= 0 && b < GROUP_BITS && ((byte >> b) & 1)) {tables[g][byte] |= size_t(1) << j;}
+            }
+        }
+    }
+    return tables;
+}
+
+template<class Weight>
+static std::vector<double> accumulateMarginal(size_t size, const std::vector<int> &bits, Weight weight)
+{
+    std::vector<std::vector<size_t>> tables = gatherTables(size, bits);
+    std::vector<std::vector<double>> partial(parallelWorkers());
+    parallelFor(size, [&](size_t begin, size_t end, unsigned worker)
+    {
+        std::vector<double> &acc = partial[worker];
+        acc.assign(size_t(1) << bits.size(), 0.0);
+        for (size_t n=begin; n<end; ++n)
+        {
+            size_t k = 0;
+            for (size_t g=0; g<tables.size(); ++g)
+            {
+                k |= tables[g][(n >> (GROUP_BITS*g)) & (GROUP_SIZE-1)];
+            }
+            acc[k] += weight(n);
+        }
+    }, 4096);
+    std::vector<double> marginal(size_t(1) << bits.size(), 0.0);
+    for (auto &acc : partial)
+    {
+        for (size_t k=0; k<acc.size(); ++k)
+        {
+            marginal[k] += acc[k];
+        }
+    }
+    return marginal;
+}
+
+std::vector<double> marginalProbabilities(const Qregister &qregister, const std::vector<int> &bits)
+{
+    return accumulateMarginal(qregister.size(), bits, [&](size_t n) {return std::norm(qregister[n]);});
+}
+
+std::vector<double> marginalProbabilities(const std::vector<double> &probabilities, const std::vector<int> &bits)
+{
+    return accumulateMarginal(probabilities.size(), bits, [&](size_t n) {return probabilities[n];});
+}
+
+std::vector<c> reducedDensityMatrix(const Qregister &qregister, const std::vector<int> &bits)
+{
+    size_t dim = size_t(1) << bits.size();
+    size_t keptMask = 0;
+    std::vector<size_t> offsets(dim, 0);
+    for (size_t j=0; j<bits.size(); ++j)
+    {
+        keptMask |= size_t(1) << bits[j];
+        for (size_t l=0; l<dim; ++l)
+        {
+            if ((l >> j) & 1) {offsets[l] |= size_t(1) << bits[j];}
+        }
+    }
+    size_t restMask = (qregister.size()-1) & ~keptMask;
+    std::vector<std::vector<c>> partial(parallelWorkers());
+    // Each block of amplitudes sharing the traced-out bits adds its outer product v v^dagger
+    parallelFor(qregister.size()/dim, [&](size_t begin, size_t end, unsigned worker)
+    {
+        std::vector<c> &acc = partial[worker];
+        acc.assign(dim*dim, c(0.0, 0.0));
+        std::vector<c> v(dim);
+        size_t base = 0;
+        for (size_t bit=1, m=restMask, i=begin; m; bit<<=1)
+        {
+            size_t lowest = m & (~m + 1);
+            if (i & bit) {base |= lowest;}
+            m ^= lowest;
+        }
+        for (size_t r=begin; r<end; ++r)
+        {
+            for (size_t l=0; l<dim; ++l)
+            {
+                v[l] = qregister[base + offsets[l]];
+            }
+            for (size_t row=0; row<dim; ++row)
+            {
+                if (v[row] == c(0.0, 0.0)) {continue;}
+                for (size_t col=0; col<dim; ++col)
+                {
+                    acc[row*dim + col] += v[row]*std::conj(v[col]);
+                }
+            }
+            base = (base - restMask) & restMask;
+        }
+    }, std::max<size_t>(1, 4096/dim));
+    std::vector<c> rho(dim*dim, c(0.0, 0.0));
+    for (auto &acc : partial)
+    {
+        for (size_t k=0; k<acc.size(); ++k)
+        {
+            rho[k] += acc[k];
+        }
+    }
+    return rho;
+}
+
+
+static size_t gatherBits(uint64_t n, const std::vector<int> &bits)
+{
+    size_t k = 0;
+    for (size_t j=0; j<bits.size(); ++j)
+    {
+        k |= size_t((n >> bits[j]) & 1) << j;
+    }
+    return k;
+}
+
+std::vector<double> marginalProbabilities(const SparseRegister &sparse, const std::vector<int> &bits)
+{
+    std::vector<double> result(size_t(1) << bits.size(), 0.0);
+    sparse.forEach([&](uint64_t n, c a)
+    {
+        result[gatherBits(n, bits)] += std::norm(a);
+    });
+    return result;
+}
+
+// Basis states sharing the traced-out bits are sorted next to each other and summed as v v^dagger
+std::vector<c> reducedDensityMatrix(const SparseRegister &sparse, const std::vector<int> &bits)
+{
+    const size_t D = size_t(1) << bits.size();
+    uint64_t mask = 0;
+    for (int b : bits)
+    {
+        mask |= uint64_t(1) << b;
+    }
+    std::vector<std::pair<uint64_t, c>> entries;
+    entries.reserve(sparse.support());
+    sparse.forEach([&](uint64_t n, c a) {entries.push_back({n, a});});
+    std::sort(entries.begin(), entries.end(), [&](const auto &x, const auto &y)
+    {
+        return (x.first & ~mask) < (y.first & ~mask);
+    });
+    std::vector<c> rho(D*D, c(0.0, 0.0));
+    for (size_t start=0; start<entries.size();)
+    {
+        size_t end = start;
+        while (end < entries.size() && (entries[end].first & ~mask) == (entries[start].first & ~mask)) {++end;}
+        for (size_t i=start; i<end; ++i)
+        {
+            size_t row = gatherBits(entries[i].first, bits);
+            for (size_t j=start; j<end; ++j)
+            {
+                rho[row*D + gatherBits(entries[j].first, bits)] += entries[i].second*std::conj(entries[j].second);
+            }
+        }
+        start = end;
+    }
+    return rho;
+}
\ No newline at end of file
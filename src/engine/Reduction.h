@@ -0,0 +1,21 @@
+#ifndef Reduction_H
+#define Reduction_H
+
+#include "Register.h"
+#include "SparseRegister.h"
+
+typedef std::complex<double> c;
+
+// Marginal distribution of the qubits at the given bit positions, bits[j] becomes bit j of the
+// result index. One parallel pass with per-worker accumulators of 2^k entries.
+std::vector<double> marginalProbabilities(const Qregister &qregister, const std::vector<int> &bits);
+std::vector<double> marginalProbabilities(const std::vector<double> &probabilities, const std::vector<int> &bits);
+
+// Row-major 2^k x 2^k density matrix of the same qubits with every other qubit traced out
+std::vector<c> reducedDensityMatrix(const Qregister &qregister, const std::vector<int> &bits);
+
+// The same from the support of a sparse register
+std::vector<double> marginalProbabilities(const SparseRegister &sparse, const std::vector<int> &bits);
+std::vector<c> reducedDensityMatrix(const SparseRegister &sparse, const std::vector<int> &bits);
+
+#endif
@@ -0,0 +1,137 @@
+#include "Register.h"
+#include "Parallel.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#endif
+
+static const std::size_t REGISTER_ALIGNMENT = 64;
+static const std::size_t PAGE_BYTES = std::size_t(1) << 12;
+static const std::size_t HUGE_PAGE_BYTES = std::size_t(1) << 21;
+
+RegisterPolicy &registerPolicy()
+{
+    static RegisterPolicy policy;
+    return policy;
+}
+
+static std::size_t roundUp(std::size_t bytes, std::size_t to)
+{
+    return (bytes + to - 1)/to*to;
+}
+
+// Touch every page from the worker that owns the matching slice of the register
+static void firstTouch(void *p, std::size_t bytes)
+{
+    char *base = static_cast<char*>(p);
+    parallelFor(bytes/PAGE_BYTES + (bytes % PAGE_BYTES != 0), [&](std::size_t begin, std::size_t end, unsigned)
+    {
+        std::size_t from = begin*PAGE_BYTES;
+        std::size_t to = std::min(end*PAGE_BYTES, bytes);
+        std::memset(base + from, 0, to - from);
+    }, 16);
+}
+
+#ifdef __linux__
+static void interleave(void *p, std::size_t bytes)
+{
+    // Interleave over every online node, e.g. "0-1" or "0,2-3"
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string ranges;
+    if (!(online>>ranges)) {return;}
+    unsigned long mask = 0;
+    std::size_t pos = 0;
+    while (pos < ranges.size())
+    {
+        std::size_t next = ranges.find(',', pos);
+        std::string range = ranges.substr(pos, next == std::string::npos ? std::string::npos : next - pos);
+        std::size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash+1));
+        for (int node=first; node<=last && node<(int)(8*sizeof(mask)); ++node)
+        {
+            mask |= 1ul << node;
+        }
+        pos = (next == std::string::npos) ? ranges.size() : next+1;
+    }
+    syscall(SYS_mbind, p, bytes, MPOL_INTERLEAVE, &mask, 8*sizeof(mask), 0);
+}
+#endif
+
+void *allocateRegister(std::size_t bytes)
+{
+    RegisterPolicy &policy = registerPolicy();
+    void *p = nullptr;
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE_BYTES)
+    {
+        std::size_t mapped = roundUp(bytes, HUGE_PAGE_BYTES);
+        if (policy.hugePages == HUGE_PAGES_EXPLICIT)
+        {
+            p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p == MAP_FAILED) {p = nullptr;}
+        }
+        if (!p)
+        {
+            p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {throw std::bad_alloc();}
+            if (policy.hugePages != HUGE_PAGES_NONE) {madvise(p, mapped, MADV_HUGEPAGE);}
+        }
+        if (policy.interleave) {interleave(p, mapped);}
+        firstTouch(p, bytes);
+        return p;
+    }
+#endif
+    std::size_t rounded = roundUp(std::max<std::size_t>(bytes, 1), REGISTER_ALIGNMENT);
+#ifdef _WIN32
+    p = _aligned_malloc(rounded, REGISTER_ALIGNMENT);
+#else
+    p = std::aligned_alloc(REGISTER_ALIGNMENT, rounded);
+#endif
+    if (!p) {throw std::bad_alloc();}
+    firstTouch(p, bytes);
+    return p;
+}
+
+void freeRegister(void *p, std::size_t bytes)
+{
+    if (!p) {return;}
+#ifdef __linux__
+    if (bytes >= HUGE_PAGE_BYTES)
+    {
+        munmap(p, roundUp(bytes, HUGE_PAGE_BYTES));
+        return;
+    }
+#endif
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+
+void resetRegister(Qregister &qregister, std::size_t size)
+{
+    if (qregister.size() == size)
+    {
+        firstTouch(qregister.data(), size*sizeof(std::complex<double>));
+    } else {
+        qregister = Qregister();
+        qregister = Qregister(size);
+    }
+    qregister[0] = std::complex<double>(1.0, 0.0);
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef Register_H
+#define Register_H
+
+#include <cstddef>
+#include <vector>
+#include <complex>
+#include <new>
+
+enum HugePages {
+    HUGE_PAGES_NONE,
+    HUGE_PAGES_TRANSPARENT,
+    HUGE_PAGES_EXPLICIT
+};
+
+struct RegisterPolicy
+{
+    HugePages hugePages = HUGE_PAGES_TRANSPARENT;
+    bool interleave = false;
+};
+
+RegisterPolicy &registerPolicy();
+
+// Returns zeroed memory aligned to at least 64 bytes. Large blocks are mapped with the
+// configured huge page and NUMA policy and zeroed by parallelFor, so first-touch places
+// each page on the node of the worker that later processes that slice of the register.
+void *allocateRegister(std::size_t bytes);
+void freeRegister(void *p, std::size_t bytes);
+
+template<class T>
+class RegisterAllocator
+{
+public:
+    typedef T value_type;
+
+    RegisterAllocator() noexcept {}
+    template<class U> RegisterAllocator(const RegisterAllocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T*>(allocateRegister(n*sizeof(T)));
+    }
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        freeRegister(p, n*sizeof(T));
+    }
+    // Memory arrives zeroed, so value-initialisation is skipped rather than redone serially.
+    // This only holds for fresh allocations: a resize that grows within the capacity would
+    // leave earlier amplitudes in the new elements. Size a Qregister through resetRegister or
+    // construction, and only resize one whose every element is overwritten afterwards.
+    template<class U> void construct(U *) noexcept {}
+    template<class U, class... Args> void construct(U *p, Args&&... args)
+    {
+        ::new((void*)p) U(std::forward<Args>(args)...);
+    }
+
+    template<class U> bool operator==(const RegisterAllocator<U> &) const noexcept {return true;}
+    template<class U> bool operator!=(const RegisterAllocator<U> &) const noexcept {return false;}
+};
+
+typedef std::vector<std::complex<double>, RegisterAllocator<std::complex<double>>> Qregister;
+
+// Puts the register in |0...0> with the given number of amplitudes, keeping the existing
+// buffer and its page placement when the size is unchanged
+void resetRegister(Qregister &qregister, std::size_t size);
+
+#endif
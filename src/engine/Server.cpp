@@ -0,0 +1,440 @@
+#include "Server.h"
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <cerrno>
+#include <csignal>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+// Socket clients served at once, later ones wait until a connection thread is free
+static const unsigned MAX_CONNECTIONS = 64;
+// How often the accept loop looks for a stop request
+static const int STOP_POLL_MS = 200;
+
+#if defined(__unix__) || defined(__APPLE__)
+static volatile std::sig_atomic_t s_stopRequested = 0;
+
+static void requestStop(int)
+{
+    s_stopRequested = 1;
+}
+#endif
+
+static double millis(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static bool readLine(FILE *in, std::string &line)
+{
+    line.clear();
+    int ch;
+    while ((ch = getc(in)) != EOF && ch != '\n')
+    {
+        line.push_back(ch);
+    }
+    return ch != EOF || !line.empty();
+}
+
+static std::vector<int> qubitList(const std::string &arg)
+{
+    std::vector<int> qubits;
+    std::istringstream qss(arg);
+    std::string q;
+    while (std::getline(qss, q, ','))
+    {
+        qubits.push_back(std::stoi(q));
+    }
+    return qubits;
+}
+
+static std::vector<size_t> inputList(const std::string &arg)
+{
+    std::vector<size_t> inputs;
+    std::istringstream iss(arg);
+    std::string n;
+    while (std::getline(iss, n, ','))
+    {
+        inputs.push_back(std::stoull(n));
+    }
+    return inputs;
+}
+
+Server::Server(unsigned maxConcurrent)
+{
+    maxConcurrent = std::max(1u, maxConcurrent);
+    for (unsigned i=0; i<maxConcurrent; ++i)
+    {
+        m_sessions.push_back(std::make_unique<Session>());
+        if (maxConcurrent > 1)
+        {
+            m_sessions.back()->workers = std::make_unique<ParallelPartition>(parallelWorkers()/maxConcurrent);
+        }
+    }
+}
+
+void Server::serveStream(FILE *in, FILE *out)
+{
+    while (handle(in, out)) {}
+}
+
+bool Server::serveSocket(const std::string &path)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr<<"server: socket path too long '"<<path<<"'"<<std::endl;
+        return false;
+    }
+    std::strcpy(addr.sun_path, path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+    {
+        std::cerr<<"server: cannot listen on '"<<path<<"': "<<std::strerror(errno)<<std::endl;
+        if (fd >= 0) {close(fd);}
+        return false;
+    }
+    // A client hanging up mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+    // SIGINT and SIGTERM shut the server down cleanly, whichever thread receives them
+    struct sigaction stop;
+    std::memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = requestStop;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+    std::cerr<<"server: listening on "<<path<<std::endl;
+    bool failed = false;
+    while (!s_stopRequested)
+    {
+        pollfd listening = {fd, POLLIN, 0};
+        int ready = poll(&listening, 1, STOP_POLL_MS);
+        if (ready < 0 && errno != EINTR)
+        {
+            std::cerr<<"server: poll failed: "<<std::strerror(errno)<<std::endl;
+            failed = true;
+            break;
+        }
+        if (ready <= 0) {continue;}
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) {continue;}
+            std::cerr<<"server: accept failed: "<<std::strerror(errno)<<std::endl;
+            failed = true;
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_connectionMutex);
+            m_pendingClients.push_back(client);
+            if (m_pendingClients.size() > m_idleThreads && m_connectionThreads.size() < MAX_CONNECTIONS)
+            {
+                m_connectionThreads.emplace_back(&Server::serveConnections, this);
+            }
+        }
+        m_connectionReady.notify_one();
+    }
+    close(fd);
+    unlink(path.c_str());
+    // Wakes the connection threads, ends the connections still open and waits for all of them
+    {
+        std::lock_guard<std::mutex> lock(m_connectionMutex);
+        m_stopping = true;
+        for (int client : m_openClients)
+        {
+            shutdown(client, SHUT_RDWR);
+        }
+    }
+    m_connectionReady.notify_all();
+    for (auto &t : m_connectionThreads)
+    {
+        t.join();
+    }
+    m_connectionThreads.clear();
+    for (int client : m_pendingClients)
+    {
+        close(client);
+    }
+    m_pendingClients.clear();
+    std::cerr<<"server: stopped"<<std::endl;
+    return !failed;
+#else
+    std::cerr<<"server: Unix domain sockets are not available here, use --server - for stdin"<<std::endl;
+    return false;
+#endif
+}
+
+void Server::serveConnections()
+{
+    std::unique_lock<std::mutex> lock(m_connectionMutex);
+    while (true)
+    {
+        ++m_idleThreads;
+        m_connectionReady.wait(lock, [this]{return m_stopping || !m_pendingClients.empty();});
+        --m_idleThreads;
+        if (m_stopping) {return;}
+        int client = m_pendingClients.front();
+        m_pendingClients.pop_front();
+        m_openClients.insert(client);
+        lock.unlock();
+        serveClient(client);
+        lock.lock();
+    }
+}
+
+void Server::serveClient(int client)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    FILE *in = fdopen(client, "r");
+    int outFd = dup(client);
+    FILE *out = (outFd >= 0) ? fdopen(outFd, "w") : nullptr;
+    if (in && out) {serveStream(in, out);}
+    // Forgotten before it is closed, so shutdown never touches a reused descriptor
+    {
+        std::lock_guard<std::mutex> lock(m_connectionMutex);
+        m_openClients.erase(client);
+    }
+    if (in) {fclose(in);} else {close(client);}
+    if (out) {fclose(out);} else if (outFd >= 0) {close(outFd);}
+#endif
+}
+
+// Answers one request, false once the connection is finished
+bool Server::handle(FILE *in, FILE *out)
+{
+    std::string line;
+    if (!readLine(in, line)) {return false;}
+    std::istringstream args(line);
+    std::string command;
+    args>>command;
+    if (command.empty()) {return true;}
+    if (command == "QUIT") {return false;}
+    Clock::time_point start = Clock::now();
+    std::string reply;
+    try
+    {
+        std::string metrics;
+        std::string output = request(command, args, in, metrics);
+        double total = millis(start, Clock::now());
+        std::ostringstream header;
+        header<<std::fixed<<std::setprecision(3)<<"OK "<<output.size()<<metrics<<" total_ms="<<total<<"\n";
+        reply = header.str() + output;
+        if (command != "STATS") {record(total, true);}
+    } catch (const std::exception &e) {
+        std::string message = std::string(e.what()) + "\n";
+        reply = "ERR " + std::to_string(message.size()) + "\n" + message;
+        record(millis(start, Clock::now()), false);
+    }
+    fwrite(reply.data(), 1, reply.size(), out);
+    fflush(out);
+    return !feof(in) && !ferror(out);
+}
+
+std::string Server::request(const std::string &command, std::istringstream &args, FILE *in, std::string &metrics)
+{
+    std::ostringstream out;
+    std::ostringstream times;
+    times<<std::fixed<<std::setprecision(3);
+    if (command == "RUN")
+    {
+        std::string script = readScript(args, in);
+        Clock::time_point start = Clock::now();
+        std::unique_ptr<Session> session = acquire();
+        Clock::time_point queued = Clock::now();
+        Clock::time_point parsed = queued;
+        try
+        {
+            Qcircuit &circuit = session->circuit;
+            circuit.clear();
+            configure(circuit, args, true);
+            circuit.readScript(script);
+            parsed = Clock::now();
+            circuit.run();
+            circuit.printRegister(out);
+        } catch (...) {
+            release(std::move(session));
+            throw;
+        }
+        release(std::move(session));
+        times<<" queue_ms="<<millis(start, queued)<<" parse_ms="<<millis(queued, parsed)<<" run_ms="<<millis(parsed, Clock::now());
+    } else if (command == "LOAD") {
+        std::string name;
+        if (!(args>>name)) {throw ParseError("LOAD needs a circuit name");}
+        std::string script = readScript(args, in);
+        std::shared_ptr<Loaded> loaded = std::make_shared<Loaded>();
+        Clock::time_point start = Clock::now();
+        std::unique_ptr<Session> slot = acquire();
+        Clock::time_point queued = Clock::now();
+        try
+        {
+            configure(loaded->circuit, args, true);
+            loaded->circuit.readScript(script);
+        } catch (...) {
+            release(std::move(slot));
+            throw;
+        }
+        release(std::move(slot));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_loaded[name] = loaded;
+        }
+        times<<" queue_ms="<<millis(start, queued)<<" parse_ms="<<millis(queued, Clock::now());
+    } else if (command == "EXEC") {
+        std::string name;
+        args>>name;
+        std::shared_ptr<Loaded> loaded;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_loaded.find(name);
+            if (it == m_loaded.end()) {throw ParseError("No loaded circuit named '"+name+"'");}
+            loaded = it->second;
+        }
+        Clock::time_point start = Clock::now();
+        std::unique_ptr<Session> slot = acquire();
+        Clock::time_point queued = Clock::now();
+        try
+        {
+            std::lock_guard<std::mutex> lock(loaded->mutex);
+            configure(loaded->circuit, args, false);
+            loaded->circuit.restart();
+            loaded->circuit.run();
+            loaded->circuit.printRegister(out);
+        } catch (...) {
+            release(std::move(slot));
+            throw;
+        }
+        release(std::move(slot));
+        times<<" queue_ms="<<millis(start, queued)<<" run_ms="<<millis(queued, Clock::now());
+    } else if (command == "DROP") {
+        std::string name;
+        args>>name;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_loaded.erase(name) == 0) {throw ParseError("No loaded circuit named '"+name+"'");}
+    } else if (command == "STATS") {
+        out<<stats();
+    } else {
+        throw ParseError("Unknown request '"+command+"'");
+    }
+    metrics = times.str();
+    return out.str();
+}
+
+// Reads the script that follows a RUN or LOAD line, its length in bytes is the next argument
+std::string Server::readScript(std::istringstream &args, FILE *in)
+{
+    size_t bytes;
+    if (!(args>>bytes)) {throw ParseError("Missing script length");}
+    std::string script(bytes, '\0');
+    size_t got = 0;
+    while (got < bytes)
+    {
+        size_t n = fread(&script[got], 1, bytes - got, in);
+        if (n == 0) {throw ParseError("Connection closed inside the script");}
+        got += n;
+    }
+    return script;
+}
+
+// Applies the server defaults and then the request options, compile options only before parsing
+void Server::configure(Qcircuit &circuit, std::istringstream &args, bool compile)
+{
+    circuit.setSeed(std::random_device{}());
+    if (compile)
+    {
+        circuit.setTrajectories(m_trajectories);
+        circuit.setOptimisation(m_level);
+        circuit.setBackend(m_backend);
+        circuit.setCache(m_cache, m_cacheEvery);
+    }
+    std::string arg;
+    while (args>>arg)
+    {
+        std::string value;
+        if (arg == "--seed" && args>>value) {
+            circuit.setSeed(std::stoull(value));
+        } else if (compile && arg == "-t" && args>>value) {
+            circuit.setTrajectories(std::max(1, std::stoi(value)));
+        } else if (compile && (arg == "-O0" || arg == "-O1" || arg == "-O2")) {
+            circuit.setOptimisation(arg[2]-'0');
+        } else if (compile && arg == "--backend" && args>>value) {
+            Backend backend;
+            if (!Qcircuit::backendFromName(value, backend)) {throw ParseError("Unknown backend '"+value+"'");}
+            circuit.setBackend(backend);
+        } else if (compile && arg == "--inputs" && args>>value) {
+            if (value == "all") {circuit.setAllInputs();}
+            else {circuit.setInputs(inputList(value));}
+        } else if (compile && arg == "--lanes" && args>>value) {
+            circuit.setLanes(std::max(1, std::stoi(value)));
+        } else if (compile && arg == "--observe" && args>>value) {
+            circuit.setObserved(qubitList(value));
+        } else if (compile && arg == "--marginal" && args>>value) {
+            circuit.addReport(false, qubitList(value));
+        } else if (compile && arg == "--rdm" && args>>value) {
+            circuit.addReport(true, qubitList(value));
+        } else {
+            throw ParseError("Unknown request option '"+arg+"'");
+        }
+    }
+}
+
+// Waits for a free session, which also caps the number of requests running at once. The
+// calling thread computes on the session's workers until it releases the session.
+std::unique_ptr<Server::Session> Server::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_available.wait(lock, [this]{return !m_sessions.empty();});
+    std::unique_ptr<Session> session = std::move(m_sessions.back());
+    m_sessions.pop_back();
+    ++m_active;
+    usePartition(session->workers.get());
+    return session;
+}
+
+void Server::release(std::unique_ptr<Session> session)
+{
+    usePartition(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sessions.push_back(std::move(session));
+        --m_active;
+    }
+    m_available.notify_one();
+}
+
+void Server::record(double ms, bool ok)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_requests;
+    if (!ok) {++m_errors;}
+    m_totalMs += ms;
+    m_maxMs = std::max(m_maxMs, ms);
+}
+
+std::string Server::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    out<<std::fixed<<std::setprecision(3)
+        <<"requests="<<m_requests
+        <<" errors="<<m_errors
+        <<" mean_ms="<<(m_requests ? m_totalMs/m_requests : 0.0)
+        <<" max_ms="<<m_maxMs
+        <<" active="<<m_active
+        <<" loaded="<<m_loaded.size()
+        <<"\n";
+    return out.str();
+}
\ No newline at end of file
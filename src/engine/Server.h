@@ -0,0 +1,87 @@
+#ifndef Server_H
+#define Server_H
+
+#include "QCircuit.h"
+#include "Parallel.h"
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <map>
+#include <set>
+#include <deque>
+#include <thread>
+
+// Long running mode that answers requests on stdin/stdout or a Unix domain socket.
+// Circuits are parsed and run by a pool of warm Qcircuit sessions, one per concurrent request,
+// so the parser tables, register buffers and worker threads outlive each request. With more
+// than one session the workers are split between them, each session computing on its own share.
+// Socket clients are served by a bounded set of connection threads.
+//
+//   RUN <bytes> [options]\n<script>          parse and run a script, options are -t, --seed, -O, --observe, --marginal, --rdm
+//   LOAD <name> <bytes> [options]\n<script>  parse and optimise a script once and keep it as <name>
+//   EXEC <name> [--seed S]\n                 run a loaded circuit from |0...0> again
+//   DROP <name>\n                            forget a loaded circuit
+//   STATS\n                                  request counters and latencies
+//   QUIT\n                                   close the connection
+//
+// Every reply is "OK <bytes> <metrics>\n<output>" or "ERR <bytes>\n<message>"
+class Server
+{
+public:
+    Server(unsigned maxConcurrent);
+    void setTrajectories(int trajectories) {m_trajectories = trajectories;}
+    void setOptimisation(int level) {m_level = level;}
+    void setBackend(Backend backend) {m_backend = backend;}
+    void setCache(StateCache *cache, size_t every) {m_cache = cache; m_cacheEvery = every;}
+    void serveStream(FILE *in, FILE *out);
+    bool serveSocket(const std::string &path);
+private:
+    struct Loaded
+    {
+        std::mutex mutex;
+        Qcircuit circuit;
+    };
+    struct Session
+    {
+        Qcircuit circuit;
+        // Null when a single session uses the shared worker pool
+        std::unique_ptr<ParallelPartition> workers;
+    };
+
+    void serveConnections();
+    void serveClient(int client);
+    bool handle(FILE *in, FILE *out);
+    std::string request(const std::string &command, std::istringstream &args, FILE *in, std::string &metrics);
+    std::string readScript(std::istringstream &args, FILE *in);
+    void configure(Qcircuit &circuit, std::istringstream &args, bool compile);
+    std::unique_ptr<Session> acquire();
+    void release(std::unique_ptr<Session> session);
+    void record(double ms, bool ok);
+    std::string stats();
+
+    int m_trajectories = 1000;
+    int m_level = 1;
+    Backend m_backend = BACKEND_AUTO;
+    StateCache *m_cache = nullptr;
+    size_t m_cacheEvery = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_available;
+    std::vector<std::unique_ptr<Session>> m_sessions;
+    unsigned m_active = 0;
+    std::map<std::string, std::shared_ptr<Loaded>> m_loaded;
+    unsigned long m_requests = 0;
+    unsigned long m_errors = 0;
+    double m_totalMs = 0;
+    double m_maxMs = 0;
+    // Connection threads and the accepted clients waiting for one of them
+    std::mutex m_connectionMutex;
+    std::condition_variable m_connectionReady;
+    std::deque<int> m_pendingClients;
+    std::set<int> m_openClients;
+    std::vector<std::thread> m_connectionThreads;
+    unsigned m_idleThreads = 0;
+    bool m_stopping = false;
+};
+
+#endif
\ No newline at end of file
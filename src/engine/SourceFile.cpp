@@ -0,0 +1,87 @@
+#include "SourceFile.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+SourceFile::~SourceFile()
+{
+    close();
+}
+
+bool SourceFile::open(const std::string &path)
+{
+    close();
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {return false;}
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        if (info.st_size == 0)
+        {
+            ::close(fd);
+            return true;
+        }
+        void *p = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            ::close(fd);
+            // Lines are read front to back, the kernel can read ahead and drop pages behind
+            madvise(p, info.st_size, MADV_SEQUENTIAL);
+            m_mapping = p;
+            m_mappedBytes = info.st_size;
+            m_text = std::string_view(static_cast<const char*>(p), m_mappedBytes);
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+    // Pipes, special files and platforms without mmap are read into memory
+    std::ifstream infile(path, std::ios::binary);
+    if (!infile) {return false;}
+    std::ostringstream contents;
+    contents<<infile.rdbuf();
+    m_copy = contents.str();
+    m_text = m_copy;
+    return true;
+}
+
+void SourceFile::assign(const std::string &text)
+{
+    close();
+    m_copy = text;
+    m_text = m_copy;
+}
+
+void SourceFile::close()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (m_mapping) {munmap(m_mapping, m_mappedBytes);}
+#endif
+    m_mapping = nullptr;
+    m_mappedBytes = 0;
+    std::string().swap(m_copy);
+    m_text = std::string_view();
+}
+
+void SourceFile::lines(std::vector<std::string_view> &lines) const
+{
+    lines.clear();
+    const char *data = m_text.data();
+    size_t size = m_text.size();
+    size_t pos = 0;
+    while (pos < size)
+    {
+        const void *newline = std::memchr(data + pos, '\n', size - pos);
+        size_t end = newline ? static_cast<const char*>(newline) - data : size;
+        lines.emplace_back(data + pos, end - pos);
+        pos = end + 1;
+    }
+}
\ No newline at end of file
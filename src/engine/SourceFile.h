@@ -0,0 +1,31 @@
+#ifndef SourceFile_H
+#define SourceFile_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Read-only text of a script. Files are memory-mapped where the platform allows, so the
+// lines handed out are views into the mapping and nothing is copied until a line is parsed.
+class SourceFile
+{
+public:
+    SourceFile() {}
+    ~SourceFile();
+    SourceFile(const SourceFile &) = delete;
+    SourceFile &operator=(const SourceFile &) = delete;
+    // False if the file cannot be read, the source is then empty
+    bool open(const std::string &path);
+    void assign(const std::string &text);
+    void close();
+    std::string_view text() const {return m_text;}
+    // Splits at '\n' like std::getline, a final newline does not start another line
+    void lines(std::vector<std::string_view> &lines) const;
+private:
+    void *m_mapping = nullptr;
+    size_t m_mappedBytes = 0;
+    std::string m_copy;
+    std::string_view m_text;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "SparseRegister.h"
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+// Amplitudes smaller than this are dropped, so cancelled branches leave the support
+static const double SPARSE_EPSILON = 1e-28;
+static const size_t MIN_CAPACITY = 16;
+
+static size_t capacityFor(size_t count)
+{
+    size_t capacity = MIN_CAPACITY;
+    while (capacity < 2*count) {capacity <<= 1;}
+    return capacity;
+}
+
+SparseRegister::SparseRegister()
+{
+    clear(0);
+}
+
+void SparseRegister::reset(int numQubits)
+{
+    m_numQubits = numQubits;
+    clear(1);
+    add(0, c(1.0, 0.0));
+}
+
+size_t SparseRegister::slot(uint64_t index) const
+{
+    size_t mask = m_keys.size() - 1;
+    uint64_t h = index * 0x9E3779B97F4A7C15ull;
+    size_t s = (h ^ (h >> 32)) & mask;
+    while (m_keys[s] != EMPTY && m_keys[s] != index)
+    {
+        s = (s + 1) & mask;
+    }
+    return s;
+}
+
+c SparseRegister::get(uint64_t index) const
+{
+    size_t s = slot(index);
+    return m_keys[s] == EMPTY ? c(0.0, 0.0) : m_values[s];
+}
+
+void SparseRegister::add(uint64_t index, c value)
+{
+    if (2*(m_count+1) > m_keys.size()) {rehash(m_keys.size()*2);}
+    size_t s = slot(index);
+    if (m_keys[s] == EMPTY)
+    {
+        m_keys[s] = index;
+        m_values[s] = value;
+        ++m_count;
+    } else {
+        m_values[s] += value;
+    }
+}
+
+void SparseRegister::clear(size_t expected)
+{
+    m_keys.assign(capacityFor(expected), EMPTY);
+    m_values.assign(m_keys.size(), c(0.0, 0.0));
+    m_count = 0;
+}
+
+void SparseRegister::rehash(size_t capacity)
+{
+    std::vector<uint64_t> keys(capacity, EMPTY);
+    std::vector<c> values(capacity);
+    keys.swap(m_keys);
+    values.swap(m_values);
+    m_count = 0;
+    for (size_t s=0; s<keys.size(); ++s)
+    {
+        if (keys[s] != EMPTY) {add(keys[s], values[s]);}
+    }
+}
+
+// Keeps the amplitudes of next that survived, next becomes the scratch table
+void SparseRegister::commit(SparseRegister &next)
+{
+    clear(next.m_count);
+    for (size_t s=0; s<next.m_keys.size(); ++s)
+    {
+        if (next.m_keys[s] != EMPTY && std::norm(next.m_values[s]) >= SPARSE_EPSILON)
+        {
+            add(next.m_keys[s], next.m_values[s]);
+        }
+    }
+}
+
+void SparseRegister::fromDense(const Qregister &qregister)
+{
+    size_t count = 0;
+    for (const c &a : qregister)
+    {
+        if (std::norm(a) >= SPARSE_EPSILON) {++count;}
+    }
+    clear(count);
+    for (size_t n=0; n<qregister.size(); ++n)
+    {
+        if (std::norm(qregister[n]) >= SPARSE_EPSILON) {add(n, qregister[n]);}
+    }
+}
+
+void SparseRegister::toDense(Qregister &qregister) const
+{
+    resetRegister(qregister, size_t(1) << m_numQubits);
+    qregister[0] = c(0.0, 0.0);
+    for (size_t s=0; s<m_keys.size(); ++s)
+    {
+        if (m_keys[s] != EMPTY) {qregister[m_keys[s]] = m_values[s];}
+    }
+}
+
+std::vector<std::pair<uint64_t, c>> SparseRegister::entries() const
+{
+    std::vector<std::pair<uint64_t, c>> result;
+    result.reserve(m_count);
+    for (size_t s=0; s<m_keys.size(); ++s)
+    {
+        if (m_keys[s] != EMPTY) {result.push_back({m_keys[s], m_values[s]});}
+    }
+    std::sort(result.begin(), result.end(), [](const auto &a, const auto &b) {return a.first < b.first;});
+    return result;
+}
+
+void SparseRegister::applyMatrix(const c *matrix, int targetBit, uint64_t controlMask)
+{
+    const uint64_t t = uint64_t(1) << targetBit;
+    SparseRegister next;
+    next.clear(2*m_count);
+    for (size_t s=0; s<m_keys.size(); ++s)
+    {
+        uint64_t i = m_keys[s];
+        if (i == EMPTY) {continue;}
+        if ((i & controlMask) != controlMask)
+        {
+            next.add(i, m_values[s]);
+            continue;
+        }
+        // Each pair is updated once, from its |0> member when that is present
+        uint64_t base = i & ~t;
+        if ((i & t) && m_keys[slot(base)] != EMPTY) {continue;}
+        c a0 = (i & t) ? c(0.0, 0.0) : m_values[s];
+        c a1 = (i & t) ? m_values[s] : get(base | t);
+        c b0 = matrix[0]*a0 + matrix[1]*a1;
+        c b1 = matrix[2]*a0 + matrix[3]*a1;
+        if (b0 != c(0.0, 0.0)) {next.add(base, b0);}
+        if (b1 != c(0.0, 0.0)) {next.add(base | t, b1);}
+    }
+    commit(next);
+}
+
+void SparseRegister::applySwap(int bit1, int bit2, uint64_t controlMask)
+{
+    SparseRegister next;
+    next.clear(m_count);
+    for (size_t s=0; s<m_keys.size(); ++s)
+    {
+        uint64_t i = m_keys[s];
+        if (i == EMPTY) {continue;}
+        if ((i & controlMask) == controlMask)
+        {
+            uint64_t x = ((i >> bit1) ^ (i >> bit2)) & 1;
+            i ^= (x << bit1) | (x << bit2);
+        }
+        next.add(i, m_values[s]);
+    }
+    commit(next);
+}
+
+void SparseRegister::applyUnitary(const std::vector<c> &matrix, const std::vector<size_t> &offsets)
+{
+    const size_t D = offsets.size();
+    uint64_t targets = 0;
+    for (size_t o : offsets)
+    {
+        targets |= o;
+    }
+    SparseRegister next;
+    next.clear(D*m_count);
+    SparseRegister done;
+    done.clear(m_count);
+    std::vector<c> in(D);
+    for (size_t s=0; s<m_keys.size(); ++s)
+    {
+        if (m_keys[s] == EMPTY) {continue;}
+        uint64_t base = m_keys[s] & ~targets;
+        if (done.m_keys[done.slot(base)] != EMPTY) {continue;}
+        done.add(base, c(1.0, 0.0));
+        for (size_t l=0; l<D; ++l)
+        {
+            in[l] = get(base | offsets[l]);
+        }
+        for (size_t r=0; r<D; ++r)
+        {
+            c acc(0.0, 0.0);
+            for (size_t l=0; l<D; ++l)
+            {
+                acc += matrix[r*D + l]*in[l];
+            }
+            if (acc != c(0.0, 0.0)) {next.add(base | offsets[r], acc);}
+        }
+    }
+    commit(next);
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef SparseRegister_H
+#define SparseRegister_H
+
+#include "Register.h"
+#include <cstdint>
+#include <vector>
+
+typedef std::complex<double> c;
+
+// Basis states with a nonzero amplitude, held in an open-addressing hash table with linear
+// probing. Gates write into a second table that is swapped in afterwards, so memory and time
+// follow the support of the state rather than 2^n.
+class SparseRegister
+{
+public:
+    SparseRegister();
+    void reset(int numQubits);
+    int numQubits() const {return m_numQubits;}
+    size_t support() const {return m_count;}
+    c get(uint64_t index) const;
+    void fromDense(const Qregister &qregister);
+    void toDense(Qregister &qregister) const;
+    // Basis states in ascending order with their amplitudes
+    std::vector<std::pair<uint64_t, c>> entries() const;
+    template<class F> void forEach(F f) const
+    {
+        for (size_t s=0; s<m_keys.size(); ++s)
+        {
+            if (m_keys[s] != EMPTY) {f(m_keys[s], m_values[s]);}
+        }
+    }
+
+    // 2x2 matrix {m00, m01, m10, m11} on the target bit wherever every control bit is set
+    void applyMatrix(const c *matrix, int targetBit, uint64_t controlMask);
+    void applySwap(int bit1, int bit2, uint64_t controlMask);
+    // Dense 2^k matrix, offsets[l] is the set of target bits of local basis state l
+    void applyUnitary(const std::vector<c> &matrix, const std::vector<size_t> &offsets);
+    // Multiplies every amplitude by phase(index)
+    template<class F> void applyDiagonal(F phase)
+    {
+        for (size_t s=0; s<m_keys.size(); ++s)
+        {
+            if (m_keys[s] != EMPTY) {m_values[s] *= phase(m_keys[s]);}
+        }
+    }
+private:
+    static constexpr uint64_t EMPTY = ~uint64_t(0);
+
+    size_t slot(uint64_t index) const;
+    void add(uint64_t index, c value);
+    void clear(size_t expected);
+    void rehash(size_t capacity);
+    void commit(SparseRegister &next);
+
+    int m_numQubits = 0;
+    size_t m_count = 0;
+    std::vector<uint64_t> m_keys;
+    std::vector<c> m_values;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "StateCache.h"
+#include <filesystem>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+typedef std::complex<double> c;
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+static const char *STATE_EXTENSION = ".qstate";
+
+static uint64_t fnv1a(uint64_t hash, const std::string &bytes)
+{
+    for (unsigned char b : bytes)
+    {
+        hash = (hash ^ b) * FNV_PRIME;
+    }
+    return hash;
+}
+
+StateCache::StateCache()
+{
+    ;
+}
+
+void StateCache::setMemoryBudget(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_memoryBudget = bytes;
+}
+
+// Cached files survive the process, the ones already in the directory are picked up here
+void StateCache::setDirectory(std::string directory, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directory = directory;
+    m_diskBudget = bytes;
+    m_onDisk.clear();
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    for (auto &file : std::filesystem::directory_iterator(directory, error))
+    {
+        if (file.path().extension() != STATE_EXTENSION) {continue;}
+        std::istringstream name(file.path().stem().string());
+        uint64_t hash;
+        if (name>>std::hex>>hash) {m_onDisk.insert(hash);}
+    }
+}
+
+bool StateCache::enabled()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_memoryBudget > 0 || !m_directory.empty();
+}
+
+std::vector<uint64_t> StateCache::prefixHashes(const std::vector<std::unique_ptr<Gate>> &gateList, int numQubits)
+{
+    std::vector<uint64_t> hashes(gateList.size()+1);
+    hashes[0] = fnv1a(FNV_OFFSET, "qatch " + std::to_string(numQubits));
+    for (size_t i=0; i<gateList.size(); ++i)
+    {
+        std::string key = gateList[i]->key();
+        std::string prefix(reinterpret_cast<const char*>(&hashes[i]), sizeof(uint64_t));
+        hashes[i+1] = fnv1a(fnv1a(FNV_OFFSET, prefix), key);
+    }
+    return hashes;
+}
+
+std::string StateCache::filePath(uint64_t hash)
+{
+    std::ostringstream name;
+    name<<std::hex<<std::setw(16)<<std::setfill('0')<<hash<<STATE_EXTENSION;
+    return (std::filesystem::path(m_directory) / name.str()).string();
+}
+
+size_t StateCache::resume(Qregister &qregister, int numQubits, const std::vector<uint64_t> &hashes, size_t limit)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i=std::min(limit, hashes.size()-1); i>0; --i)
+    {
+        auto it = m_entries.find(hashes[i]);
+        if (it != m_entries.end() && it->second.cursor == i && it->second.state.size() == qregister.size())
+        {
+            std::copy(it->second.state.begin(), it->second.state.end(), qregister.begin());
+            it->second.lastUse = ++m_clock;
+            return i;
+        }
+        if (!m_onDisk.count(hashes[i])) {continue;}
+        std::string path = filePath(hashes[i]);
+        CheckpointHeader header;
+        bool ok = Checkpointer::readState(path, qregister, header, [&](const CheckpointHeader &h)
+        {
+            return h.numQubits == (uint32_t)numQubits && h.cursor == i && h.circuitHash == hashes[i];
+        });
+        if (ok)
+        {
+            std::error_code error;
+            std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+            insert(qregister, i, hashes[i]);
+            return i;
+        }
+        // A torn or foreign file, forget it and put the register back to |0...0>
+        m_onDisk.erase(hashes[i]);
+        resetRegister(qregister, qregister.size());
+    }
+    return 0;
+}
+
+void StateCache::store(const Qregister &qregister, int numQubits, size_t cursor, uint64_t hash)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(hash);
+    if (it != m_entries.end())
+    {
+        it->second.lastUse = ++m_clock;
+    } else {
+        insert(qregister, cursor, hash);
+    }
+    if (m_directory.empty() || m_onDisk.count(hash)) {return;}
+    // The checkpoint header carries the prefix length as the cursor and the prefix hash
+    CheckpointHeader header;
+    header.numQubits = numQubits;
+    header.flags = 0;
+    header.cursor = cursor;
+    header.gateCount = cursor;
+    header.circuitHash = hash;
+    if (Checkpointer::writeState(filePath(hash), qregister, header))
+    {
+        m_onDisk.insert(hash);
+        trimDirectory();
+    }
+}
+
+// Keeps the state in memory if it fits the budget, evicting the least recently used ones
+void StateCache::insert(const Qregister &qregister, size_t cursor, uint64_t hash)
+{
+    size_t bytes = qregister.size()*sizeof(c);
+    if (bytes > m_memoryBudget) {return;}
+    while (m_memoryUsed + bytes > m_memoryBudget && !m_entries.empty())
+    {
+        auto oldest = std::min_element(m_entries.begin(), m_entries.end(), [](const auto &a, const auto &b)
+        {
+            return a.second.lastUse < b.second.lastUse;
+        });
+        m_memoryUsed -= oldest->second.state.size()*sizeof(c);
+        m_entries.erase(oldest);
+    }
+    Entry &entry = m_entries[hash];
+    entry.state.assign(qregister.begin(), qregister.end());
+    entry.cursor = cursor;
+    entry.lastUse = ++m_clock;
+    m_memoryUsed += bytes;
+}
+
+// Deletes the least recently used files until the directory fits its budget
+void StateCache::trimDirectory()
+{
+    struct File
+    {
+        std::filesystem::file_time_type time;
+        uintmax_t size;
+        uint64_t hash;
+    };
+    std::vector<File> files;
+    uintmax_t total = 0;
+    for (uint64_t hash : m_onDisk)
+    {
+        std::error_code error;
+        std::string path = filePath(hash);
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if (error) {continue;}
+        files.push_back({std::filesystem::last_write_time(path, error), size, hash});
+        total += size;
+    }
+    std::sort(files.begin(), files.end(), [](const File &a, const File &b) {return a.time < b.time;});
+    for (size_t i=0; i<files.size() && total > m_diskBudget; ++i)
+    {
+        std::error_code error;
+        std::filesystem::remove(filePath(files[i].hash), error);
+        m_onDisk.erase(files[i].hash);
+        total -= files[i].size;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef StateCache_H
+#define StateCache_H
+
+#include "Gate.h"
+#include "Checkpoint.h"
+#include <map>
+#include <set>
+#include <mutex>
+#include <cstdint>
+
+// Register states reached after a prefix of the compiled gate stream, keyed by a hash of
+// that prefix. States are kept in memory up to a byte budget and, when a directory is set,
+// written there in the checkpoint format (bounded by its own budget) for later runs.
+class StateCache
+{
+public:
+    StateCache();
+    void setMemoryBudget(size_t bytes);
+    void setDirectory(std::string directory, size_t bytes);
+    bool enabled();
+    // hashes[i] identifies the first i gates on a register of numQubits qubits
+    static std::vector<uint64_t> prefixHashes(const std::vector<std::unique_ptr<Gate>> &gateList, int numQubits);
+    // Loads the longest cached prefix of at most limit gates, returns its length or 0
+    size_t resume(Qregister &qregister, int numQubits, const std::vector<uint64_t> &hashes, size_t limit);
+    void store(const Qregister &qregister, int numQubits, size_t cursor, uint64_t hash);
+private:
+    struct Entry
+    {
+        Qregister state;
+        size_t cursor;
+        uint64_t lastUse;
+    };
+
+    void insert(const Qregister &qregister, size_t cursor, uint64_t hash);
+    void trimDirectory();
+    std::string filePath(uint64_t hash);
+
+    std::mutex m_mutex;
+    size_t m_memoryBudget = 0;
+    size_t m_memoryUsed = 0;
+    uint64_t m_clock = 0;
+    std::map<uint64_t, Entry> m_entries;
+    std::string m_directory;
+    size_t m_diskBudget = 0;
+    std::set<uint64_t> m_onDisk;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef Tokenizer_H
+#define Tokenizer_H
+
+#include <string_view>
+#include <charconv>
+
+// Reads whitespace separated words and numbers from a line in place. Each read skips leading
+// whitespace and stops where the matching istringstream extraction would.
+class Tokenizer
+{
+public:
+    explicit Tokenizer(std::string_view text) : m_text(text) {}
+
+    bool word(std::string_view &w)
+    {
+        skipSpace();
+        if (m_pos == m_text.size()) {return false;}
+        size_t start = m_pos;
+        while (m_pos < m_text.size() && !isSpace(m_text[m_pos])) {++m_pos;}
+        w = m_text.substr(start, m_pos - start);
+        return true;
+    }
+
+    bool integer(int &value)
+    {
+        skipSpace();
+        const char *first = m_text.data() + m_pos;
+        const char *last = m_text.data() + m_text.size();
+        if (first != last && *first == '+' && first+1 != last && *(first+1) != '-') {++first;}
+        std::from_chars_result result = std::from_chars(first, last, value);
+        if (result.ec != std::errc()) {return false;}
+        m_pos = result.ptr - m_text.data();
+        return true;
+    }
+
+    bool character(char &ch)
+    {
+        skipSpace();
+        if (m_pos == m_text.size()) {return false;}
+        ch = m_text[m_pos++];
+        return true;
+    }
+
+    static bool isSpace(char ch)
+    {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v';
+    }
+
+private:
+    void skipSpace()
+    {
+        while (m_pos < m_text.size() && isSpace(m_text[m_pos])) {++m_pos;}
+    }
+
+    std::string_view m_text;
+    size_t m_pos = 0;
+};
+
+#endif
\ No newline at end of file
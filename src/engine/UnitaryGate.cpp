@@ -0,0 +1,120 @@
+#include "UnitaryGate.h"
+#include "Parallel.h"
+#include "SparseRegister.h"
+#include <algorithm>
+
+typedef std::complex<double> c;
+
+UnitaryGate::UnitaryGate(std::vector<int> qubits, std::vector<c> matrix)
+{
+    m_name = "unitary";
+    m_qubits = qubits;
+    m_matrix = matrix;
+    int k = qubits.size();
+    m_offsets.assign(size_t(1) << k, 0);
+    for (size_t l=0; l<m_offsets.size(); ++l)
+    {
+        for (int j=0; j<k; ++j)
+        {
+            if ((l >> (k-1-j)) & 1) {m_offsets[l] |= size_t(1) << (qubits[j]-1);}
+        }
+    }
+    for (int q : qubits)
+    {
+        m_sortedBits.push_back(q-1);
+    }
+    std::sort(m_sortedBits.begin(), m_sortedBits.end());
+}
+
+void UnitaryGate::remap(const std::vector<int> &map)
+{
+    std::vector<int> qubits;
+    for (int q : m_qubits)
+    {
+        qubits.push_back(map[q]);
+    }
+    *this = UnitaryGate(qubits, m_matrix);
+}
+
+// Index of the i-th block with every target bit cleared
+static inline size_t blockBase(size_t i, const int *sortedBits, int k)
+{
+    for (int j=0; j<k; ++j)
+    {
+        size_t low = i & ((size_t(1) << sortedBits[j]) - 1);
+        i = ((i >> sortedBits[j]) << (sortedBits[j]+1)) | low;
+    }
+    return i;
+}
+
+template<int K>
+static void applyDense(Qregister &qregister, const c *matrix, const size_t *offsets, const int *sortedBits)
+{
+    const int D = 1 << K;
+    parallelFor(qregister.size() >> K, [&](size_t begin, size_t end, unsigned)
+    {
+        c in[D];
+        c *a = qregister.data();
+        for (size_t i=begin; i<end; ++i)
+        {
+            size_t base = blockBase(i, sortedBits, K);
+            for (int l=0; l<D; ++l)
+            {
+                in[l] = a[base + offsets[l]];
+            }
+            for (int r=0; r<D; ++r)
+            {
+                c acc(0.0, 0.0);
+                for (int l=0; l<D; ++l)
+                {
+                    acc += matrix[r*D + l]*in[l];
+                }
+                a[base + offsets[r]] = acc;
+            }
+        }
+    }, 1024);
+}
+
+static void applyDenseGeneric(Qregister &qregister, const c *matrix, const size_t *offsets, const int *sortedBits, int k)
+{
+    const size_t D = size_t(1) << k;
+    parallelFor(qregister.size() >> k, [&](size_t begin, size_t end, unsigned)
+    {
+        std::vector<c> in(D);
+        c *a = qregister.data();
+        for (size_t i=begin; i<end; ++i)
+        {
+            size_t base = blockBase(i, sortedBits, k);
+            for (size_t l=0; l<D; ++l)
+            {
+                in[l] = a[base + offsets[l]];
+            }
+            for (size_t r=0; r<D; ++r)
+            {
+                c acc(0.0, 0.0);
+                for (size_t l=0; l<D; ++l)
+                {
+                    acc += matrix[r*D + l]*in[l];
+                }
+                a[base + offsets[r]] = acc;
+            }
+        }
+    }, 64);
+}
+
+bool UnitaryGate::actSparse(SparseRegister &sparse)
+{
+    sparse.applyUnitary(m_matrix, m_offsets);
+    return true;
+}
+
+void UnitaryGate::act(Qregister &qregister)
+{
+    switch (m_qubits.size())
+    {
+        case 1 : applyDense<1>(qregister, m_matrix.data(), m_offsets.data(), m_sortedBits.data()); return;
+        case 2 : applyDense<2>(qregister, m_matrix.data(), m_offsets.data(), m_sortedBits.data()); return;
+        case 3 : applyDense<3>(qregister, m_matrix.data(), m_offsets.data(), m_sortedBits.data()); return;
+    }
+    applyDenseGeneric(qregister, m_matrix.data(), m_offsets.data(), m_sortedBits.data(), m_qubits.size());
+}
@@ -0,0 +1,26 @@
+#ifndef UnitaryGate_H
+#define UnitaryGate_H
+
+#include "Gate.h"
+
+// Dense 2^k x 2^k unitary on k qubits, row-major, the first listed qubit is the most
+// significant bit of the row/column index. Each pass loads the 2^k amplitudes of one
+// block, multiplies and stores them back in place.
+class UnitaryGate : public Gate
+{
+public:
+	UnitaryGate(std::vector<int> qubits, std::vector<c> matrix);
+	void act(Qregister &qregister);
+	bool actSparse(SparseRegister &sparse);
+	std::vector<int> qubits() {return m_qubits;}
+	std::string key() {std::string k = Gate::key(); appendKey(k, m_matrix); return k;}
+	void remap(const std::vector<int> &map);
+	std::vector<c> matrix() {return m_matrix;}
+protected:
+	std::vector<int> m_qubits;
+	std::vector<c> m_matrix;
+	std::vector<size_t> m_offsets;
+	std::vector<int> m_sortedBits;
+};
+
+#endif
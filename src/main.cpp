@@ -1,10 +1,194 @@
 #include "engine/QCircuit.h"
+#include "engine/Server.h"
 
-int main(int argc, char** argv)
+static int usage()
+{
+    std::cerr<<"usage: qatch [options] <script>"<<std::endl
+        <<"       qatch [options] --server <socket path | ->"<<std::endl
+        <<"  -t, --trajectories N   Monte Carlo trajectories for noisy circuits (default 1000)"<<std::endl
+        <<"  --seed S               seed for the trajectory random streams"<<std::endl
+        <<"  -j, --threads N        number of worker threads"<<std::endl
+        <<"  --checkpoint-every N   write a checkpoint every N gates"<<std::endl
+        <<"  --checkpoint-file F    checkpoint path (default <script>.ckpt)"<<std::endl
+        <<"  --checkpoint-compress  zero-run compress checkpoints"<<std::endl
+        <<"  --resume               continue from the last checkpoint"<<std::endl
+        <<"  -O0, -O1, -O2         optimisation level (default 1)"<<std::endl
+        <<"  --hugepages MODE       none, transparent (default) or explicit huge pages for the register"<<std::endl
+        <<"  --interleave           interleave the register over all NUMA nodes"<<std::endl
+        <<"  --backend MODE         auto (default), dense or sparse state vector"<<std::endl
+        <<"  --inputs N1,N2,...     run the circuit on these basis states (or all) instead of |0...0>"<<std::endl
+        <<"  --lanes B              inputs simulated together in one register (default 8)"<<std::endl
+        <<"  --observe Q1,Q2,...    only simulate what affects these qubits and print their distribution"<<std::endl
+        <<"  --marginal Q1,Q2,...   print the marginal distribution of these qubits"<<std::endl
+        <<"  --rdm Q1,Q2,...        print the reduced density matrix of these qubits"<<std::endl
+        <<"  --cache-memory MB      keep register states after shared gate prefixes in memory"<<std::endl
+        <<"  --cache-dir DIR        also keep them in DIR for later runs"<<std::endl
+        <<"  --cache-disk MB        size budget of the cache directory (default 4096)"<<std::endl
+        <<"  --cache-every N        cache a state every N gates besides checkpoints and the end"<<std::endl
+        <<"  --server PATH          serve requests on a Unix domain socket, or stdin/stdout for -"<<std::endl
+        <<"  --max-concurrent N     requests the server runs at once (default 1)"<<std::endl;
+    return 1;
+}
+
+static std::vector<int> qubitList(std::string arg)
+{
+    std::vector<int> qubits;
+    std::istringstream qss(arg);
+    std::string q;
+    while (std::getline(qss, q, ','))
+    {
+        qubits.push_back(std::stoi(q));
+    }
+    return qubits;
+}
+
+static std::vector<size_t> inputList(std::string arg)
+{
+    std::vector<size_t> inputs;
+    std::istringstream iss(arg);
+    std::string n;
+    while (std::getline(iss, n, ','))
+    {
+        inputs.push_back(std::stoull(n));
+    }
+    return inputs;
+}
+
+static int run(int argc, char** argv)
 {
     Qcircuit circuit;
-    circuit.readFile(argv[1]);
-    circuit.run();
-    circuit.printRegister();
+    std::string filename;
+    std::string checkpointFile;
+    size_t checkpointEvery = 0;
+    bool checkpointCompress = false;
+    std::string serverPath;
+    unsigned maxConcurrent = 1;
+    int trajectories = 1000;
+    int level = 1;
+    Backend backend = BACKEND_AUTO;
+    StateCache cache;
+    size_t cacheMemory = 0;
+    std::string cacheDir;
+    size_t cacheDisk = 4096;
+    size_t cacheEvery = 0;
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = (i+1 < argc);
+        if ((arg == "-t" || arg == "--trajectories") && hasValue) {
+            trajectories = std::max(1, std::stoi(argv[++i]));
+            circuit.setTrajectories(trajectories);
+        } else if (arg == "--seed" && hasValue) {
+            circuit.setSeed(std::stoull(argv[++i]));
+        } else if ((arg == "-j" || arg == "--threads") && hasValue) {
+            setParallelWorkers(std::max(1, std::stoi(argv[++i])));
+        } else if (arg == "--checkpoint-every" && hasValue) {
+            checkpointEvery = std::stoull(argv[++i]);
+        } else if (arg == "--checkpoint-file" && hasValue) {
+            checkpointFile = argv[++i];
+        } else if (arg == "--checkpoint-compress") {
+            checkpointCompress = true;
+        } else if (arg == "--resume") {
+            circuit.setResume(true);
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            level = arg[2]-'0';
+            circuit.setOptimisation(level);
+        } else if (arg == "--hugepages" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "none") {registerPolicy().hugePages = HUGE_PAGES_NONE;}
+            else if (mode == "transparent") {registerPolicy().hugePages = HUGE_PAGES_TRANSPARENT;}
+            else if (mode == "explicit") {registerPolicy().hugePages = HUGE_PAGES_EXPLICIT;}
+            else {return usage();}
+        } else if (arg == "--interleave") {
+            registerPolicy().interleave = true;
+        } else if (arg == "--backend" && hasValue) {
+            if (!Qcircuit::backendFromName(argv[++i], backend)) {return usage();}
+            circuit.setBackend(backend);
+        } else if (arg == "--inputs" && hasValue) {
+            std::string list = argv[++i];
+            if (list == "all") {circuit.setAllInputs();}
+            else {circuit.setInputs(inputList(list));}
+        } else if (arg == "--lanes" && hasValue) {
+            circuit.setLanes(std::max(1, std::stoi(argv[++i])));
+        } else if (arg == "--observe" && hasValue) {
+            circuit.setObserved(qubitList(argv[++i]));
+        } else if (arg == "--marginal" && hasValue) {
+            circuit.addReport(false, qubitList(argv[++i]));
+        } else if (arg == "--rdm" && hasValue) {
+            circuit.addReport(true, qubitList(argv[++i]));
+        } else if (arg == "--cache-memory" && hasValue) {
+            cacheMemory = std::stoull(argv[++i]);
+        } else if (arg == "--cache-dir" && hasValue) {
+            cacheDir = argv[++i];
+        } else if (arg == "--cache-disk" && hasValue) {
+            cacheDisk = std::stoull(argv[++i]);
+        } else if (arg == "--cache-every" && hasValue) {
+            cacheEvery = std::stoull(argv[++i]);
+        } else if (arg == "--server" && hasValue) {
+            serverPath = argv[++i];
+        } else if (arg == "--max-concurrent" && hasValue) {
+            maxConcurrent = std::max(1, std::stoi(argv[++i]));
+        } else if (arg.rfind("-", 0) != 0 && filename.empty()) {
+            filename = arg;
+        } else {
+            return usage();
+        }
+    }
+    cache.setMemoryBudget(cacheMemory << 20);
+    if (!cacheDir.empty()) {cache.setDirectory(cacheDir, cacheDisk << 20);}
+    circuit.setCache(&cache, cacheEvery);
+    if (!serverPath.empty())
+    {
+#ifdef QATCH_MPI
+        if (DistributedRegister::processes() > 1)
+        {
+            std::cerr<<"The server runs in a single process"<<std::endl;
+            return 1;
+        }
+#endif
+        Server server(maxConcurrent);
+        server.setTrajectories(trajectories);
+        server.setOptimisation(level);
+        server.setBackend(backend);
+        server.setCache(&cache, cacheEvery);
+        if (serverPath == "-")
+        {
+            server.serveStream(stdin, stdout);
+            return 0;
+        }
+        return server.serveSocket(serverPath) ? 0 : 1;
+    }
+    if (filename.empty()) {return usage();}
+    circuit.setCheckpoint(checkpointFile.empty() ? filename+".ckpt" : checkpointFile, checkpointEvery, checkpointCompress);
+    try
+    {
+        circuit.readFile(filename);
+    } catch (const ParseError &e) {
+        std::cerr<<e.what()<<std::endl;
+        return 1;
+    }
+    // The reports behind the output can fail too, distributed ones are collective
+    try
+    {
+        circuit.run();
+        circuit.printRegister();
+    } catch (const std::exception &e) {
+        std::cerr<<e.what()<<std::endl;
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char** argv)
+{
+#ifdef QATCH_MPI
+    // Only the main thread calls MPI, the worker pool just computes
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    int status = run(argc, argv);
+    MPI_Finalize();
+    return status;
+#else
+    return run(argc, argv);
+#endif
+}